@@ -0,0 +1,354 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ *
+ *  Microbenchmarks of the grpc_client_plugin hot paths on synthetic blocks, no node or network
+ *  needed. Every benchmark takes the transactions per block and the percentage of them that are
+ *  eosio.token transfers; the others call a contract without an abi. Besides ns per block they
+ *  report allocations per block (allocs/op) and per transaction (allocs/trx).
+ */
+#include <eosio/grpc_client_plugin/abi_cache.hpp>
+#include <eosio/grpc_client_plugin/arena_pool.hpp>
+#include <eosio/grpc_client_plugin/block_packing.hpp>
+#include <eosio/grpc_client_plugin/ingest_queue.hpp>
+#include <eosio/grpc_client_plugin/json_writer.hpp>
+#include <eosio/chain/abi_serializer.hpp>
+#include <eosio/chain/asset.hpp>
+#include <eosio/chain/block.hpp>
+#include <eosio/chain/transaction.hpp>
+
+#include <fc/io/json.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include "block.pb.h"
+
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new( size_t size ) {
+   allocations.fetch_add( 1, std::memory_order_relaxed );
+   if( void* p = std::malloc( size ? size : 1 ))
+      return p;
+   throw std::bad_alloc();
+}
+void operator delete( void* p ) noexcept { std::free( p ); }
+void operator delete( void* p, size_t ) noexcept { std::free( p ); }
+
+namespace bench {
+
+using namespace eosio;
+using namespace eosio::chain;
+
+struct transfer {
+   account_name   from;
+   account_name   to;
+   asset          quantity;
+   std::string    memo;
+};
+
+}
+
+FC_REFLECT( bench::transfer, (from)(to)(quantity)(memo) )
+
+namespace bench {
+
+const fc::microseconds max_serialization_time = fc::seconds( 10 );
+
+abi_def token_abi() {
+   abi_def abi;
+   abi.version = "eosio::abi/1.0";
+   abi.structs.emplace_back( struct_def{ "transfer", "", {
+      { "from", "name" }, { "to", "name" }, { "quantity", "asset" }, { "memo", "string" } } } );
+   abi.actions.emplace_back( action_def{ N(transfer), "transfer", "" } );
+   return abi;
+}
+
+signed_block_ptr make_block( uint32_t trx_count, uint32_t transfer_percent ) {
+   auto block = std::make_shared<signed_block>();
+   for( uint32_t i = 0; i < trx_count; ++i ) {
+      signed_transaction trx;
+      trx.expiration = fc::time_point_sec( 1500000000 + i );
+      trx.ref_block_num = i;
+      action act;
+      if( i % 100 < transfer_percent ) {
+         act.account = N(eosio.token);
+         act.name = N(transfer);
+         act.authorization = { permission_level{ N(alice), N(active) } };
+         act.data = fc::raw::pack( transfer{ N(alice), N(bob), asset::from_string( "1.0000 EOS" ), "benchmark transfer " + std::to_string( i ) } );
+      } else {
+         act.account = N(bench.opaque);
+         act.name = N(doit);
+         act.authorization = { permission_level{ N(bob), N(active) } };
+         act.data = bytes( 64, char( i ));
+      }
+      trx.actions.emplace_back( std::move( act ));
+      transaction_receipt receipt( packed_transaction( trx, packed_transaction::none ));
+      receipt.cpu_usage_us = 100;
+      receipt.net_usage_words = 16;
+      block->transactions.emplace_back( std::move( receipt ));
+   }
+   return block;
+}
+
+std::vector<transaction> unpack_block( const signed_block& block ) {
+   std::vector<transaction> result;
+   for( const auto& receipt : block.transactions )
+      result.emplace_back( fc::raw::unpack<transaction>( receipt.trx.get<packed_transaction>().get_raw_transaction() ));
+   return result;
+}
+
+/// the cache and resolver grpc_client_plugin_impl::to_variant_with_abi uses
+struct abi_resolver {
+   abi_cache cache{ 2048, 8, max_serialization_time };
+
+   abi_resolver() {
+      cache.set( N(eosio.token), fc::raw::pack( token_abi() ));
+      cache.set( N(bench.opaque), bytes() );
+   }
+
+   abi_serializer_ref resolve( account_name n ) {
+      abi_serializer_ref ref;
+      cache.lookup( n, ref );
+      return ref;
+   }
+
+   fc::variant to_variant( const transaction& trx ) {
+      fc::variant v;
+      abi_serializer::to_variant( trx, v, [this]( account_name n ) { return resolve( n ); }, max_serialization_time );
+      return v;
+   }
+
+   void write_json( json_buffer& out, const transaction& trx ) {
+      write_transaction_json( out, trx, [this]( account_name n ) { return resolve( n ); }, max_serialization_time );
+   }
+};
+
+/// mirrors grpc_client_plugin_impl::serialize_transaction for json export
+void fill_json( abi_resolver& resolver, const packed_transaction& pt, force_block::BlockTransRequest& out ) {
+   const auto trx = fc::raw::unpack<transaction>( pt.get_raw_transaction() );
+   out.set_trxid( trx.id().str() );
+   out.set_trx( fc::json::to_string( resolver.to_variant( trx )));
+}
+
+/// fill_json with grpc-client-json-writer=stream
+void fill_json_stream( abi_resolver& resolver, json_buffer& buffer, const packed_transaction& pt, force_block::BlockTransRequest& out ) {
+   const auto trx = fc::raw::unpack<transaction>( pt.get_raw_transaction() );
+   out.set_trxid( trx.id().str() );
+   buffer.clear();
+   resolver.write_json( buffer, trx );
+   out.set_trx( buffer.str() );
+}
+
+/// counts allocations made while it is alive and reports them per iteration and per transaction
+class allocation_counter {
+public:
+   explicit allocation_counter( benchmark::State& s ) : state( s ), start( allocations.load() ) {}
+   ~allocation_counter() {
+      const double allocs = allocations.load() - start;
+      const double trx = state.range( 0 ) ? state.range( 0 ) : 1;
+      state.counters["allocs/op"] = benchmark::Counter( allocs, benchmark::Counter::kAvgIterations );
+      state.counters["allocs/trx"] = benchmark::Counter( allocs / trx, benchmark::Counter::kAvgIterations );
+      state.SetItemsProcessed( state.iterations() * state.range( 0 ));
+   }
+private:
+   benchmark::State& state;
+   uint64_t          start;
+};
+
+void BM_unpack( benchmark::State& state ) {
+   const auto block = make_block( state.range( 0 ), state.range( 1 ));
+   allocation_counter counter( state );
+   for( auto _ : state )
+      benchmark::DoNotOptimize( unpack_block( *block ));
+}
+
+void BM_to_variant_with_abi( benchmark::State& state ) {
+   const auto trxs = unpack_block( *make_block( state.range( 0 ), state.range( 1 )));
+   abi_resolver resolver;
+   allocation_counter counter( state );
+   for( auto _ : state ) {
+      for( const auto& trx : trxs )
+         benchmark::DoNotOptimize( resolver.to_variant( trx ));
+   }
+}
+
+void BM_json_to_string( benchmark::State& state ) {
+   abi_resolver resolver;
+   std::vector<fc::variant> variants;
+   for( const auto& trx : unpack_block( *make_block( state.range( 0 ), state.range( 1 ))))
+      variants.emplace_back( resolver.to_variant( trx ));
+   allocation_counter counter( state );
+   for( auto _ : state ) {
+      for( const auto& v : variants )
+         benchmark::DoNotOptimize( fc::json::to_string( v ));
+   }
+}
+
+void BM_block_request_json( benchmark::State& state ) {
+   const auto block = make_block( state.range( 0 ), state.range( 1 ));
+   abi_resolver resolver;
+   allocation_counter counter( state );
+   for( auto _ : state ) {
+      force_block::BlockRequest request;
+      request.set_blocknum( block->block_num() );
+      for( const auto& receipt : block->transactions )
+         fill_json( resolver, receipt.trx.get<packed_transaction>(), *request.add_trans() );
+      benchmark::DoNotOptimize( request.SerializeAsString() );
+   }
+}
+
+void BM_json_writer( benchmark::State& state ) {
+   const auto trxs = unpack_block( *make_block( state.range( 0 ), state.range( 1 )));
+   abi_resolver resolver;
+   json_buffer buffer;
+   // the writer must print exactly what to_variant_with_abi and fc::json print
+   for( const auto& trx : trxs ) {
+      buffer.clear();
+      resolver.write_json( buffer, trx );
+      if( buffer.str() != fc::json::to_string( resolver.to_variant( trx ))) {
+         state.SkipWithError( "json_writer output differs from fc::json" );
+         return;
+      }
+   }
+   allocation_counter counter( state );
+   for( auto _ : state ) {
+      for( const auto& trx : trxs ) {
+         buffer.clear();
+         resolver.write_json( buffer, trx );
+         benchmark::DoNotOptimize( buffer.str().data() );
+      }
+   }
+}
+
+void BM_block_request_json_stream( benchmark::State& state ) {
+   const auto block = make_block( state.range( 0 ), state.range( 1 ));
+   abi_resolver resolver;
+   json_buffer buffer;
+   allocation_counter counter( state );
+   for( auto _ : state ) {
+      force_block::BlockRequest request;
+      request.set_blocknum( block->block_num() );
+      for( const auto& receipt : block->transactions )
+         fill_json_stream( resolver, buffer, receipt.trx.get<packed_transaction>(), *request.add_trans() );
+      benchmark::DoNotOptimize( request.SerializeAsString() );
+   }
+}
+
+void BM_block_request_binary( benchmark::State& state ) {
+   const auto block = make_block( state.range( 0 ), state.range( 1 ));
+   allocation_counter counter( state );
+   for( auto _ : state ) {
+      force_block::BlockRequest request;
+      request.set_blocknum( block->block_num() );
+      for( const auto& receipt : block->transactions )
+         fill_packed_transaction( receipt, *request.add_trans() );
+      benchmark::DoNotOptimize( request.SerializeAsString() );
+   }
+}
+
+/// the same request built on a pooled arena, as grpc_client_plugin_impl does
+void BM_block_request_binary_arena( benchmark::State& state ) {
+   const auto block = make_block( state.range( 0 ), state.range( 1 ));
+   arena_pool arenas;
+   allocation_counter counter( state );
+   for( auto _ : state ) {
+      auto arena = arenas.get();
+      auto* request = google::protobuf::Arena::CreateMessage<force_block::BlockRequest>( arena.get() );
+      request->set_blocknum( block->block_num() );
+      for( const auto& receipt : block->transactions )
+         fill_packed_transaction( receipt, *request->add_trans() );
+      benchmark::DoNotOptimize( request->SerializeAsString() );
+   }
+}
+
+/**
+ * Handoff of blocks from the signal thread to a consume thread parked the way
+ * grpc_client_plugin_impl::consume_blocks parks, one block per iteration.
+ */
+void BM_queue_handoff( benchmark::State& state ) {
+   const auto block = make_block( state.range( 0 ), state.range( 1 ));
+   ingest_queue<signed_block_ptr> queue;
+   std::mutex mtx;
+   std::condition_variable condition;
+   std::atomic_bool sleeping{false};
+   std::atomic_bool done{false};
+   std::atomic<uint64_t> consumed{0};
+   // the fence pairing of wake_consumer and consume_blocks, so a push never misses a parked consumer
+   auto wake = [&]() {
+      std::atomic_thread_fence( std::memory_order_seq_cst );
+      if( sleeping.load( std::memory_order_relaxed )) {
+         std::lock_guard<std::mutex> lock( mtx );
+         condition.notify_one();
+      }
+   };
+   queue.configure( 1024, queue_overflow_policy::block, std::chrono::seconds( 1 ), wake );
+
+   std::thread consumer( [&]() {
+      std::deque<signed_block_ptr> process;
+      while( !done ) {
+         if( queue.empty() ) {
+            std::unique_lock<std::mutex> lock( mtx );
+            sleeping.store( true, std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+            while( queue.empty() && !done )
+               condition.wait( lock );
+            sleeping.store( false, std::memory_order_relaxed );
+         }
+         consumed += queue.drain( process );
+         process.clear();
+      }
+   } );
+
+   uint64_t produced = 0;
+   {
+      allocation_counter counter( state );
+      for( auto _ : state ) {
+         queue.push( block );
+         wake();
+         ++produced;
+      }
+      while( consumed < produced )
+         std::this_thread::yield();
+   }
+   done = true;
+   wake();
+   {
+      std::lock_guard<std::mutex> lock( mtx );
+      condition.notify_one();
+   }
+   consumer.join();
+}
+
+/// transactions per block x percentage of eosio.token transfers, GRPC_BENCH_TRX and GRPC_BENCH_TRANSFER_PERCENT pick one mix
+void block_mix( benchmark::internal::Benchmark* b ) {
+   b->ArgNames( { "trx", "transfer%" } );
+   const char* trx = std::getenv( "GRPC_BENCH_TRX" );
+   const char* transfer_percent = std::getenv( "GRPC_BENCH_TRANSFER_PERCENT" );
+   if( trx || transfer_percent ) {
+      b->Args( { trx ? std::atoll( trx ) : 100, transfer_percent ? std::atoll( transfer_percent ) : 100 } );
+      return;
+   }
+   for( auto args : std::vector<std::vector<int64_t>>{ { 10, 100 }, { 100, 100 }, { 100, 50 }, { 1000, 90 } } )
+      b->Args( args );
+}
+
+BENCHMARK( BM_unpack )->Apply( block_mix );
+BENCHMARK( BM_to_variant_with_abi )->Apply( block_mix );
+BENCHMARK( BM_json_to_string )->Apply( block_mix );
+BENCHMARK( BM_json_writer )->Apply( block_mix );
+BENCHMARK( BM_block_request_json )->Apply( block_mix );
+BENCHMARK( BM_block_request_json_stream )->Apply( block_mix );
+BENCHMARK( BM_block_request_binary )->Apply( block_mix );
+BENCHMARK( BM_block_request_binary_arena )->Apply( block_mix );
+BENCHMARK( BM_queue_handoff )->Apply( block_mix )->UseRealTime();
+
+}
+
+BENCHMARK_MAIN();
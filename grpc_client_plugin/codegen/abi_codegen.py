@@ -0,0 +1,202 @@
+#!/usr/bin/env python
+"""Generate typed decoders for hot contract actions from their abis.
+
+For every requested action found in an abi this emits a C++ struct with FC_REFLECT, so
+fc::raw::unpack reads the action data directly, and a dispatcher that builds the protobuf
+request of the action's stream. Actions that are not generated keep going through the
+generic abi_serializer path in grpc_client_plugin.
+
+usage: abi_codegen.py --output hot_actions.hpp --abi eosio.token=eosio.token.abi --actions transfer,issue
+"""
+
+import argparse
+import json
+import re
+import sys
+
+BUILTIN_TYPES = {
+    'bool': 'bool',
+    'int8': 'int8_t', 'uint8': 'uint8_t',
+    'int16': 'int16_t', 'uint16': 'uint16_t',
+    'int32': 'int32_t', 'uint32': 'uint32_t',
+    'int64': 'int64_t', 'uint64': 'uint64_t',
+    'int128': '__int128', 'uint128': 'unsigned __int128',
+    'varint32': 'fc::signed_int', 'varuint32': 'fc::unsigned_int',
+    'float32': 'float', 'float64': 'double',
+    'time_point': 'fc::time_point', 'time_point_sec': 'fc::time_point_sec',
+    'block_timestamp_type': 'chain::block_timestamp_type',
+    'name': 'chain::name', 'account_name': 'chain::name', 'permission_name': 'chain::name',
+    'action_name': 'chain::name', 'table_name': 'chain::name', 'scope_name': 'chain::name',
+    'bytes': 'chain::bytes', 'string': 'std::string',
+    'checksum160': 'fc::ripemd160', 'checksum256': 'fc::sha256', 'checksum512': 'fc::sha512',
+    'transaction_id_type': 'fc::sha256', 'block_id_type': 'fc::sha256',
+    'public_key': 'chain::public_key_type', 'signature': 'chain::signature_type',
+    'symbol': 'chain::symbol', 'symbol_code': 'chain::symbol_code',
+    'asset': 'chain::asset', 'extended_asset': 'chain::extended_asset',
+}
+
+# streams a generated action can feed, keyed by the field layout they need
+TRANSFER_FIELDS = [('from', 'chain::name'), ('to', 'chain::name'), ('quantity', 'chain::asset'), ('memo', 'std::string')]
+
+
+def char_to_symbol(c):
+    if 'a' <= c <= 'z':
+        return ord(c) - ord('a') + 6
+    if '1' <= c <= '5':
+        return ord(c) - ord('1') + 1
+    return 0
+
+
+def string_to_name(s):
+    """Same encoding as eosio::chain::string_to_name"""
+    value = 0
+    for i in range(13):
+        c = char_to_symbol(s[i]) if i < len(s) else 0
+        if i < 12:
+            c &= 0x1f
+            c <<= 64 - 5 * (i + 1)
+        else:
+            c &= 0x0f
+        value |= c
+    return value
+
+
+def identifier(s):
+    return re.sub(r'[^A-Za-z0-9_]', '_', s)
+
+
+class AbiTypes(object):
+    def __init__(self, account, abi):
+        self.account = account
+        self.prefix = identifier(account)
+        self.typedefs = dict((t['new_type_name'], t['type']) for t in abi.get('types', []))
+        self.structs = dict((s['name'], s) for s in abi.get('structs', []))
+        self.actions = dict((a['name'], a['type']) for a in abi.get('actions', []))
+        self.emitted = []
+        self.emitted_names = set()
+
+    def resolve(self, t):
+        while t in self.typedefs:
+            t = self.typedefs[t]
+        return t
+
+    def struct_name(self, name):
+        return '%s_%s' % (self.prefix, identifier(name))
+
+    def cpp_type(self, t):
+        """C++ type of an abi type, emitting the structs it depends on first"""
+        if t.endswith('[]'):
+            return 'std::vector<%s>' % self.cpp_type(t[:-2])
+        if t.endswith('?'):
+            return 'fc::optional<%s>' % self.cpp_type(t[:-1])
+        t = self.resolve(t)
+        if t in BUILTIN_TYPES:
+            return BUILTIN_TYPES[t]
+        if t in self.structs:
+            self.emit_struct(t)
+            return self.struct_name(t)
+        raise ValueError('unsupported abi type %s in %s' % (t, self.account))
+
+    def fields(self, name):
+        s = self.structs[name]
+        result = []
+        if s.get('base'):
+            result.extend(self.fields(self.resolve(s['base'])))
+        for f in s['fields']:
+            result.append((f['name'], self.cpp_type(f['type'])))
+        return result
+
+    def emit_struct(self, name):
+        if name in self.emitted_names:
+            return
+        self.emitted_names.add(name)
+        self.emitted.append((self.struct_name(name), self.fields(name)))
+
+
+def generate(abis, actions):
+    structs = []
+    decoders = []
+    for account, path in abis:
+        with open(path) as f:
+            types = AbiTypes(account, json.load(f))
+        for action in actions:
+            if action not in types.actions:
+                continue
+            try:
+                type_name = types.resolve(types.actions[action])
+                types.emit_struct(type_name)
+            except ValueError as e:
+                sys.stderr.write('abi_codegen: skipping %s::%s, %s\n' % (account, action, e))
+                continue
+            decoders.append((account, action, types.struct_name(type_name), types.fields(type_name)))
+        structs.extend(types.emitted)
+
+    out = []
+    out.append('// generated by abi_codegen.py from the contract abis, do not edit')
+    out.append('#pragma once')
+    out.append('')
+    out.append('#include <eosio/chain/action.hpp>')
+    out.append('#include <eosio/chain/asset.hpp>')
+    out.append('#include <eosio/chain/types.hpp>')
+    out.append('#include <fc/io/raw.hpp>')
+    out.append('')
+    out.append('#include "transfer.pb.h"')
+    out.append('')
+    out.append('namespace eosio { namespace hot_actions {')
+    out.append('')
+    for name, fields in structs:
+        out.append('struct %s {' % name)
+        for field, cpp in fields:
+            out.append('   %s %s;' % (cpp, identifier(field)))
+        out.append('};')
+        out.append('')
+    out.append('} }')
+    out.append('')
+    for name, fields in structs:
+        if fields:
+            out.append('FC_REFLECT( eosio::hot_actions::%s, %s )' % (name, ''.join('(%s)' % identifier(f) for f, _ in fields)))
+        else:
+            out.append('FC_REFLECT_EMPTY( eosio::hot_actions::%s )' % name)
+    out.append('')
+    out.append('namespace eosio { namespace hot_actions {')
+    out.append('')
+    out.append('/// @return true if act is a transfer shaped action with a generated decoder, out is filled then')
+    out.append('inline bool build_transfer_request( const chain::action& act, force_transfer::TransferRequest& out ) {')
+    for account, action, name, fields in decoders:
+        if fields != TRANSFER_FIELDS:
+            continue
+        out.append('   if( act.account.value == %dull && act.name.value == %dull ) { // %s::%s' %
+                   (string_to_name(account), string_to_name(action), account, action))
+        out.append('      const auto data = fc::raw::unpack<%s>( act.data );' % name)
+        out.append('      out.set_from( data.from.to_string() );')
+        out.append('      out.set_to( data.to.to_string() );')
+        out.append('      out.set_amount( data.quantity.to_string() );')
+        out.append('      out.set_memo( data.memo );')
+        out.append('      return true;')
+        out.append('   }')
+    out.append('   return false;')
+    out.append('}')
+    out.append('')
+    out.append('} }')
+    return '\n'.join(out) + '\n'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--output', required=True)
+    parser.add_argument('--abi', action='append', default=[], help='account=path of an abi json file')
+    parser.add_argument('--actions', default='transfer', help='comma separated action names to generate')
+    args = parser.parse_args()
+
+    abis = []
+    for spec in args.abi:
+        account, _, path = spec.partition('=')
+        abis.append((account, path))
+    actions = [a for a in args.actions.split(',') if a]
+
+    with open(args.output, 'w') as f:
+        f.write(generate(abis, actions))
+
+
+if __name__ == '__main__':
+    main()
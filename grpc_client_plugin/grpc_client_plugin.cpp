@@ -3,30 +3,56 @@
  *  @copyright defined in eos/LICENSE.txt
  */
 #include <eosio/grpc_client_plugin/grpc_client_plugin.hpp>
+#include <eosio/grpc_client_plugin/ingest_queue.hpp>
+#include <eosio/grpc_client_plugin/abi_cache.hpp>
+#include <eosio/grpc_client_plugin/block_spool.hpp>
+#include <eosio/grpc_client_plugin/action_filter.hpp>
+#include <eosio/grpc_client_plugin/arena_pool.hpp>
+#include <eosio/grpc_client_plugin/block_log_reader.hpp>
+#include <eosio/grpc_client_plugin/block_packing.hpp>
+#include <eosio/grpc_client_plugin/export_cursor.hpp>
+#include <eosio/grpc_client_plugin/json_writer.hpp>
+#include <eosio/grpc_client_plugin/memory_budget.hpp>
+#include <eosio/chain/account_object.hpp>
+#include <eosio/chain/contract_types.hpp>
 #include <eosio/chain/eosio_contract.hpp>
 #include <eosio/chain/config.hpp>
 #include <eosio/chain/exceptions.hpp>
 #include <eosio/chain/transaction.hpp>
 #include <eosio/chain/types.hpp>
 
+#include <fc/compress/zlib.hpp>
 #include <fc/io/json.hpp>
+#include <fc/scoped_exit.hpp>
 #include <fc/utf8.hpp>
 #include <fc/variant.hpp>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <boost/chrono.hpp>
 #include <boost/signals2/connection.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition_variable.hpp>
 
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <map>
 #include <queue>
+#include <random>
+#include <unordered_map>
 #include <eosio/chain/genesis_state.hpp>
 #include <grpcpp/grpcpp.h>
 #include "eosio_grpc_client.grpc.pb.h"
 #include "transfer.grpc.pb.h"
 #include "transaction.grpc.pb.h"
 #include "block.grpc.pb.h"
+#include "trace.grpc.pb.h"
+#include "hot_actions.hpp"
 
 namespace fc { class variant; }
 
@@ -45,6 +71,8 @@ using chain::packed_transaction;
 using grpc::Status;
 using grpc::Channel;
 using grpc::ClientContext;
+using grpc::CompletionQueue;
+using grpc::ClientAsyncResponseReader;
 using eosio_grpc_client::EosRequest;
 using eosio_grpc_client::EosReply;
 using eosio_grpc_client::Eos_Service;
@@ -60,38 +88,347 @@ using force_transaction::TransactionReply;
 using force_block::grpc_block;
 using force_block::BlockTransRequest;
 using force_block::BlockRequest;
+using force_block::BlockBatchRequest;
 using force_block::BlockReply;
+using force_block::HeadBlockEvent;
+
+using force_trace::grpc_trace;
+using force_trace::ActionTrace;
+using force_trace::TransactionTrace;
+using force_trace::BlockTraces;
+using force_trace::TraceReply;
 
 
 static appbase::abstract_plugin& _grpc_client_plugin = app().register_plugin<grpc_client_plugin>();
 
+struct rpc_retry_policy {
+   std::chrono::milliseconds deadline{5000};
+   uint32_t                  max_retries = 5;
+   std::chrono::milliseconds backoff_min{100};
+   std::chrono::milliseconds backoff_max{10000};
+   uint32_t                  breaker_failures = 5;
+   std::chrono::milliseconds breaker_cooldown{10000};
+
+   // capped exponential backoff with equal jitter
+   std::chrono::milliseconds backoff(uint32_t attempt) const {
+      static thread_local std::mt19937 rng(std::random_device{}());
+      const auto cap = std::min<int64_t>(backoff_max.count(), backoff_min.count() << std::min<uint32_t>(attempt, 20));
+      std::uniform_int_distribution<int64_t> jitter(0, cap / 2);
+      return std::chrono::milliseconds(cap - cap / 2 + jitter(rng));
+   }
+};
+
+/**
+ * Stops sending to a downstream that keeps failing: after breaker_failures consecutive failures
+ * calls fail fast for breaker_cooldown, then the first result while half open decides whether
+ * to close again or reopen.
+ */
+class circuit_breaker {
+public:
+   void configure(uint32_t failures, std::chrono::milliseconds cooldown) {
+      std::lock_guard<std::mutex> lock(mtx_);
+      threshold_ = std::max<uint32_t>(failures, 1);
+      cooldown_ = cooldown;
+   }
+
+   bool allow() {
+      std::lock_guard<std::mutex> lock(mtx_);
+      if( state_ == state::open && std::chrono::steady_clock::now() >= open_until_ )
+         state_ = state::half_open;
+      return state_ != state::open;
+   }
+
+   void record_success() {
+      std::lock_guard<std::mutex> lock(mtx_);
+      if( state_ != state::closed )
+         ilog( "grpc_client circuit breaker closed" );
+      state_ = state::closed;
+      failures_ = 0;
+   }
+
+   void record_failure() {
+      std::lock_guard<std::mutex> lock(mtx_);
+      if( state_ == state::half_open || ++failures_ >= threshold_ ) {
+         if( state_ != state::open )
+            wlog( "grpc_client circuit breaker open for ${ms} ms after ${f} failures", ("ms", cooldown_.count())("f", failures_) );
+         state_ = state::open;
+         open_until_ = std::chrono::steady_clock::now() + cooldown_;
+      }
+   }
+
+private:
+   enum class state { closed, open, half_open };
+   std::mutex                             mtx_;
+   state                                  state_ = state::closed;
+   uint32_t                               failures_ = 0;
+   uint32_t                               threshold_ = 5;
+   std::chrono::milliseconds              cooldown_{10000};
+   std::chrono::steady_clock::time_point  open_until_;
+};
+
+// names a streamed request in the log, block streams by block number, transfers by transaction
+template<typename Request>
+std::string call_label(const Request& request) { return std::to_string(request.blocknum()); }
+inline std::string call_label(const TransferRequest& request) { return request.trxid(); }
+
 class grpc_stub
 {
 public:
-  grpc_stub(std::shared_ptr<Channel> channel)
-      : stub_(Eos_Service::NewStub(channel)),
-      transfer_stub_(grpc_transfer::NewStub(channel)),
-      transaction_stub_(grpc_transaction::NewStub(channel)),
-      block_stub_(grpc_block::NewStub(channel)) {}
+  // block calls are spread round-robin over all channels, the other services use the first one
+  grpc_stub(const std::vector<std::shared_ptr<Channel>>& channels)
+      : channels_(channels),
+      stub_(Eos_Service::NewStub(channels.front())),
+      transfer_stub_(grpc_transfer::NewStub(channels.front())),
+      transaction_stub_(grpc_transaction::NewStub(channels.front())),
+      trace_stub_(grpc_trace::NewStub(channels.front())),
+      traces_(*this, "traces of block", [this](ClientContext* context, const BlockTraces& request, CompletionQueue* cq) {
+         return trace_stub_->PrepareAsyncrpc_sendtraces(context, request, cq);
+      }),
+      head_events_(*this, "head event of block", [this](ClientContext* context, const HeadBlockEvent& request, CompletionQueue* cq) {
+         return block_stubs_.front()->PrepareAsyncrpc_sendhead(context, request, cq);
+      }),
+      transfers_(*this, "transfer of transaction", [this](ClientContext* context, const TransferRequest& request, CompletionQueue* cq) {
+         return transfer_stub_->PrepareAsyncrpc_sendaction(context, request, cq);
+      }) {
+     for( const auto& channel : channels )
+        block_stubs_.emplace_back(grpc_block::NewStub(channel));
+  }
   std::string PutRequest(std::string action,std::string json);
   std::string PutTransferRequest(std::string from,std::string to,std::string amount,std::string memo,std::string trx_id);
   std::string PutTransactionRequest(int blocknum,std::string trxjson,std::string trx_id);
-  std::string PutBlockRequest(int blocknum,vector<BlockTransRequest> &blockTrans);
-  ~grpc_stub(){}
+
+  void SetRetryPolicy(const rpc_retry_policy& policy) {
+     policy_ = policy;
+     breaker_.configure(policy.breaker_failures, policy.breaker_cooldown);
+  }
+  // waits for the channel to connect and a warm-up call to succeed
+  bool WarmUp();
+  bool Ready() const { return ready_; }
+  bool Allow() { return breaker_.allow(); }
+  // no more retries or backoff, in-flight calls still complete within their deadline
+  void Stop() { stopping_ = true; }
+
+  // Block export is pipelined: up to block_window_ calls are in flight on
+  // block_cq_ and they are retired strictly in the order they were sent.
+  void SetBlockWindow(uint32_t window) { block_window_ = std::max<uint32_t>(window, 1); }
+  // overrides the channel default compression for block calls
+  void SetBlockCompression(grpc_compression_algorithm algorithm) { block_compression_ = algorithm; block_compression_set_ = true; }
+  // records the latency of every completed block call
+  void SetLatencyHistogram(latency_histogram* histogram) { latency_histogram_ = histogram; }
+  // invoked from the sending thread for every block call, in send order
+  void SetBlockCallback(std::function<void(const BlockRequest&, const Status&)> cb) { block_callback_ = std::move(cb); }
+  // With batching, consecutive blocks are coalesced into one rpc_sendblocks call until the
+  // batch reaches the byte limit or has been open for max_delay. The byte limit starts low and
+  // is doubled or halved as the measured call latency stays below or goes above target_latency.
+  void SetBatching(uint64_t max_bytes, std::chrono::milliseconds max_delay, std::chrono::milliseconds target_latency);
+  // an empty request marks a block without transactions, only sent when batching;
+  // request lives on arena, which is kept until the call is retired
+  void PutBlockRequestAsync(arena_pool::arena_ptr arena, BlockRequest* request);
+  // also sends an open batch once it is older than max_delay, and held calls once they may go
+  void PollBlockRequests();
+  void FlushBlockRequests();
+  // blocks held back by a retry backoff or an open breaker, the owner has to keep polling
+  bool BlockRequestsWaiting() const { return !block_held_.empty() || BlockBackingOff(); }
+  // transfer, trace and head block streams, each pipelined on its own queue and retried in place
+  void PutTransferRequestAsync(TransferRequest&& request) { transfers_.Put(std::move(request)); }
+  void FlushTransferRequests() { transfers_.Flush(); }
+  void PutTraceRequestAsync(BlockTraces&& request) { traces_.Put(std::move(request)); }
+  void FlushTraceRequests() { traces_.Flush(); }
+  void PutHeadEventAsync(HeadBlockEvent&& event) { head_events_.Put(std::move(event)); }
+  void FlushHeadEvents() { head_events_.Flush(); }
+  // restarts stream calls whose backoff is over
+  void PollStreams() { transfers_.Poll(); traces_.Poll(); head_events_.Poll(); }
+  bool StreamsWaiting() const { return transfers_.Waiting() || traces_.Waiting() || head_events_.Waiting(); }
+  ~grpc_stub();
 private:
+  /**
+   * Calls of one unary rpc kept in flight on a completion queue of their own, up to the block
+   * window, retired in send order and retried in place with the stub's retry policy. A failed
+   * call waits out its backoff at the front without blocking the caller, later requests are
+   * held meanwhile and Poll restarts it once it is due.
+   * Calls are named in the log by call_label() of their request.
+   */
+  template<typename Request, typename Reply>
+  class call_window {
+  public:
+     using prepare_fn = std::function<std::unique_ptr<ClientAsyncResponseReader<Reply>>(ClientContext*, const Request&, CompletionQueue*)>;
+     call_window(grpc_stub& stub, const char* what, prepare_fn prepare) : stub_(stub), what_(what), prepare_(std::move(prepare)) {}
+     ~call_window();
+     void Put(Request&& request);
+     void Poll() { Dispatch(); }
+     void Flush();
+     bool Waiting() const { return !held_.empty() || BackingOff(); }
+  private:
+     struct call {
+        Request request;
+        Reply reply;
+        ClientContext context;
+        Status status;
+        std::unique_ptr<ClientAsyncResponseReader<Reply>> reader;
+        std::chrono::steady_clock::time_point retry_at;
+        uint32_t attempt = 0;
+        bool finished = false;
+        bool backing_off = false;
+     };
+     std::unique_ptr<call> Start(std::unique_ptr<call> c);
+     void Dispatch();
+     void Reap(bool wait_front);
+     bool BackingOff() const { return !calls_.empty() && calls_.front()->backing_off; }
+
+     grpc_stub& stub_;
+     const char* what_;
+     prepare_fn prepare_;
+     CompletionQueue cq_;
+     std::deque<std::unique_ptr<call>> calls_;
+     std::deque<std::unique_ptr<call>> held_; ///< not started yet, behind a full window in backoff
+  };
+
+  struct block_call {
+     arena_pool::arena_ptr arena;                     ///< holds request or batch
+     std::vector<arena_pool::arena_ptr> block_arenas; ///< arenas of the blocks batch points into
+     BlockRequest* request = nullptr;
+     BlockBatchRequest* batch = nullptr;              ///< set for rpc_sendblocks calls
+     uint64_t bytes = 0;
+     BlockReply reply;
+     ClientContext context;
+     Status status;
+     std::unique_ptr<ClientAsyncResponseReader<BlockReply>> reader;
+     std::chrono::steady_clock::time_point started;
+     std::chrono::steady_clock::time_point retry_at;
+     uint32_t attempt = 0;
+     bool finished = false;
+     bool backing_off = false;                        ///< failed, restarted at retry_at once the breaker allows
+
+     std::string blocks() const {
+        if( !batch )
+           return std::to_string(request->blocknum());
+        return std::to_string(batch->first_blocknum()) + "-" + std::to_string(batch->last_blocknum());
+     }
+  };
+  void ReapBlockRequests(bool wait_front);
+  void SendBlockCall(std::unique_ptr<block_call> call);
+  void DispatchBlockCalls();
+  bool BlockBackingOff() const { return !block_calls_.empty() && block_calls_.front()->backing_off; }
+  std::unique_ptr<block_call> StartBlockCall(std::unique_ptr<block_call> call);
+  void AddToBatch(arena_pool::arena_ptr arena, BlockRequest* request);
+  void SendBatch();
+  void ReportBlockCall(const block_call& call);
+  void AdaptBatchLimit(const block_call& call);
+  bool Retryable(const Status& status) const;
+  void SetDeadline(ClientContext& context) const {
+     context.set_deadline(std::chrono::system_clock::now() + policy_.deadline);
+  }
+
+  std::vector<std::shared_ptr<Channel>> channels_;
+  rpc_retry_policy policy_;
+  circuit_breaker breaker_;
+  std::atomic_bool ready_{false};
+  std::atomic_bool stopping_{false};
+
   std::unique_ptr<Eos_Service::Stub> stub_;
   std::unique_ptr<grpc_transfer::Stub> transfer_stub_;
   std::unique_ptr<grpc_transaction::Stub> transaction_stub_;
-  std::unique_ptr<grpc_block::Stub> block_stub_;
+  std::unique_ptr<grpc_trace::Stub> trace_stub_;
+  std::vector<std::unique_ptr<grpc_block::Stub>> block_stubs_;
+  size_t next_block_stub_ = 0;
+  grpc_compression_algorithm block_compression_ = GRPC_COMPRESS_NONE;
+  bool block_compression_set_ = false;
+
+  CompletionQueue block_cq_;
+  std::deque<std::unique_ptr<block_call>> block_calls_;
+  // not started yet: behind a full window whose front backs off, or while the breaker is open
+  std::deque<std::unique_ptr<block_call>> block_held_;
+  uint32_t block_window_ = 1;
+  std::function<void(const BlockRequest&, const Status&)> block_callback_;
+  latency_histogram* latency_histogram_ = nullptr;
+
+  std::unique_ptr<block_call> batch_; ///< open batch, not sent yet
+  std::chrono::steady_clock::time_point batch_opened_;
+  uint64_t batch_max_bytes_ = 0;      ///< 0 disables batching
+  uint64_t batch_min_bytes_ = 0;
+  uint64_t batch_limit_ = 0;          ///< current adaptive byte limit
+  std::chrono::milliseconds batch_max_delay_{50};
+  std::chrono::milliseconds batch_target_latency_{200};
+  double batch_latency_ms_ = 0;       ///< moving average of batch call latency
+
+  // declared last so they are destroyed, and their queues drained, before the stubs
+  call_window<BlockTraces, TraceReply> traces_;
+  call_window<HeadBlockEvent, BlockReply> head_events_;
+  call_window<TransferRequest, TransferReply> transfers_;
+};
+
+struct export_metrics {
+   std::atomic<uint64_t> blocks_sent{0};
+   std::atomic<uint64_t> blocks_failed{0};
+   std::atomic<uint64_t> transactions_sent{0};
+   std::atomic<uint64_t> bytes_sent{0};           ///< uncompressed message bytes
+   // gRPC does not report wire sizes, so every compression_sample_rate-th block is deflated
+   // locally to estimate the compression ratio
+   std::atomic<uint64_t> sampled_bytes{0};
+   std::atomic<uint64_t> sampled_compressed_bytes{0};
+   std::atomic<uint32_t> last_acked_block{0};
+   std::atomic<int64_t>  last_ack_time{0};        ///< unix seconds
+   latency_histogram     rpc_latency;             ///< ns per block call, batches included
+   latency_histogram     block_bytes;
+
+   double compression_ratio() const {
+      const auto compressed = sampled_compressed_bytes.load();
+      return compressed ? double( sampled_bytes.load() ) / compressed : 1.0;
+   }
 };
 
-class grpc_client_plugin_impl {
+/**
+ * One downstream endpoint of the block export with its own channel, in-flight window,
+ * optional spool and metrics.
+ */
+struct export_partition {
+   uint32_t                      index = 0;
+   std::string                   address;
+   std::unique_ptr<grpc_stub>    stub;
+   boost::thread                 connect_thread;
+   // with a spool the consume thread only appends to it and sender_thread does all the rpcs
+   std::unique_ptr<block_spool>  spool;
+   boost::thread                 sender_thread;
+   bool                          send_failed = false; ///< sender thread only
+   export_metrics                metrics;
+};
+
+class grpc_client_plugin_impl : public std::enable_shared_from_this<grpc_client_plugin_impl> {
 public:
    grpc_client_plugin_impl(){}
    ~grpc_client_plugin_impl();
-   std::string client_address = std::string("");
+   std::vector<std::string> client_addresses;
+   grpc::ChannelArguments channel_arguments( uint32_t subchannel ) const;
+   grpc_compression_algorithm channel_compression = GRPC_COMPRESS_NONE;
+   fc::optional<grpc_compression_algorithm> block_compression;
+   uint32_t max_message_mb = 64;
+   uint32_t stream_window_kb = 0;
+   uint32_t keepalive_ms = 0;
+   uint32_t keepalive_timeout_ms = 20000;
+   uint32_t subchannels = 1;
+   static constexpr uint64_t compression_sample_rate = 64;
    void init();
+   void connect(export_partition& p);
    boost::thread client_thread;
+   rpc_retry_policy retry_policy;
+   fc::path spool_dir;
+   uint64_t spool_segment_size = 64 * 1024 * 1024;
+   std::atomic_bool sender_done{false};
+
+   // how irreversible block exports are spread over the partitions
+   enum class partition_mode { block, receiver, actor };
+   partition_mode partition_by = partition_mode::block;
+   // block mode, consume thread only: blocks with transactions go round-robin, empty ones follow the block before them
+   size_t next_block_partition = 0;
+   size_t last_block_partition = 0;
+   // block messages are built on pooled arenas that stay alive until their call is retired
+   arena_pool message_arenas;
+   std::vector<std::unique_ptr<export_partition>> partitions;
+   uint32_t partition_of( const transaction& trx ) const;
+   void export_block( export_partition& p, const arena_pool::arena_ptr& arena, BlockRequest* request );
+   // transactions rejected by transaction_filter, dropped from the request before it is sent
+   static constexpr uint32_t filtered_partition = uint32_t(-1);
+   action_filter transaction_filter;
    void consume_blocks();
    
    void insert_default_abi();
@@ -109,55 +446,197 @@ public:
    //void _process_accepted_transaction(const chain::transaction_metadata_ptr&);
    void process_applied_transaction(const chain::transaction_trace_ptr&);
    //void _process_applied_transaction(const chain::transaction_trace_ptr&);
-   void process_accepted_block( const chain::block_state_ptr& );
-   //void _process_accepted_block( const chain::block_state_ptr& );
-   void process_irreversible_block(const chain::block_state_ptr&);
-   void _process_irreversible_block(const chain::block_state_ptr&);
-   template<typename Queue, typename Entry> void queue(Queue& queue, const Entry& e);
-
-   optional<abi_serializer> get_abi_serializer( account_name n );
+   struct accepted_block_entry;
+   void process_accepted_block( const accepted_block_entry& );
+   void _process_accepted_block( const accepted_block_entry& );
+   void process_irreversible_block(const chain::signed_block_ptr&);
+   void _process_irreversible_block(const chain::signed_block_ptr&);
+   void serialize_transaction(const chain::transaction_receipt& receipt, BlockTransRequest& out, uint32_t& partition, std::vector<TransferRequest>* transfers);
+   void pack_transaction(const chain::transaction_receipt& receipt, BlockTransRequest& out, uint32_t& partition, std::vector<TransferRequest>* transfers);
+   void collect_transfers(const transaction& trx, const std::string& trx_id, std::vector<TransferRequest>& out);
+   bool transfer_stream = false;
+
+   // trace stream; applied transaction traces and accepted blocks share transaction_trace_queue
+   // so the traces arrive in the order they were applied, each followed by the block they went into
+   struct trace_entry {
+      chain::transaction_trace_ptr trace;
+      chain::block_state_ptr       block;
+      uint64_t                     charged = 0; ///< bytes charged to memory
+   };
+   bool trace_stream = false;
+   // traces applied since the last accepted block, the last one of each transaction wins;
+   // speculative traces of transactions not in the block are dropped with it
+   std::map<transaction_id_type, chain::transaction_trace_ptr> block_traces;
+   chain::transaction_trace_ptr onblock_trace;
+   std::atomic<uint64_t> traces_sent{0};
+   std::atomic<uint64_t> traces_dropped{0};
+   void process_trace_block(const chain::block_state_ptr& bs);
+
+   // head block stream, the branch exported so far back to the last irreversible block
+   struct head_block {
+      uint32_t      blocknum;
+      block_id_type id;
+      block_id_type previous;
+   };
+   struct accepted_block_entry {
+      chain::block_state_ptr      bs; ///< null when downgraded to the header fields
+      head_block                  block;
+      uint32_t                    irreversible = 0;
+      chain::block_timestamp_type timestamp;
+      account_name                producer;
+      uint64_t                    charged = 0;
+   };
+   bool head_stream = false;
+   std::deque<head_block> head_blocks;
+   std::atomic<uint64_t> head_blocks_undone{0};
+   std::atomic<uint32_t> last_head_block{0};
+   void send_head_event(HeadBlockEvent::Kind kind, const head_block& b, uint32_t irreversible, HeadBlockEvent&& event);
+   void fill_transaction_trace(const chain::transaction_trace& trace, TransactionTrace& out);
+   void fill_action_trace(const chain::action_trace& atrace, ActionTrace& out);
+   void send_pending_blocks(size_t keep);
+   void send_spooled_blocks(export_partition& p);
+   template<typename Queue, typename Entry> bool queue(Queue& queue, const Entry& e);
+   bool queues_empty() const;
+   bool backlogs_empty() const;
+   void wake_consumer();
+
+   // the consume thread exports irreversible blocks first; every other stream is then served for
+   // at most stream_budget per round and keeps the rest of its backlog for the next round
+   struct stream_stats {
+      explicit stream_stats( const char* n ) : name( n ) {}
+      const char*           name;
+      std::atomic<uint64_t> processed{0};
+      std::atomic<uint64_t> deferred{0}; ///< rounds that ran out of budget with entries left
+   };
+   std::chrono::microseconds stream_budget{2000};
+   stream_stats accepted_block_stats{"accepted_block"};
+   stream_stats applied_transaction_stats{"applied_transaction"};
+   stream_stats accepted_transaction_stats{"accepted_transaction"};
+   void drain_queues();
+   void export_irreversible();
+   template<typename Entry, typename Process>
+   void run_stream(stream_stats& stats, std::deque<Entry>& backlog, Process&& process);
+
+   abi_serializer_ref get_abi_serializer( account_name n );
+   bool fetch_abi( account_name n );
+   void learn_abi( const chain::action_trace& atrace );
+   void learn_abi( const transaction& trx );
+   void learn_abi( const packed_transaction& pt );
+   void learn_abi( const chain::action& act );
    template<typename T> fc::variant to_variant_with_abi( const T& obj );
 
-   void purge_abi_cache();
-
    fc::microseconds abi_serializer_max_time;
-   size_t abi_cache_size = 0;
-   struct by_account;
-   struct by_last_access;
-
-   struct abi_cache {
-      account_name                     account;
-      fc::time_point                   last_accessed;
-      fc::optional<abi_serializer>     serializer;
+   size_t abi_cache_size = 2048;
+   uint32_t abi_cache_shards = 8;
+   fc::path abi_cache_snapshot;
+   abi_cache abi_cache_index;
+   // abis being read from chain state on the main thread, concurrent misses of an account share
+   // the read and stop waiting for it at the same deadline
+   struct abi_fetch {
+      std::shared_future<void>              done;
+      std::chrono::steady_clock::time_point deadline;
+   };
+   std::mutex abi_fetch_mtx;
+   std::unordered_map<uint64_t, abi_fetch> abi_fetches;
+
+   // irreversible blocks whose transactions are being serialized on serialize_pool,
+   // kept in block order and sent from the front once every part is done
+   struct pending_block {
+      chain::signed_block_ptr block;
+      arena_pool::arena_ptr arena;
+      BlockRequest* request = nullptr; ///< on arena
+      std::vector<uint32_t> trans_partition; ///< partition of each request.trans() entry
+      std::vector<std::vector<TransferRequest>> transfers; ///< transfer stream entries of each request.trans() entry
+      std::vector<std::future<void>> parts;
+   };
+   std::deque<std::unique_ptr<pending_block>> pending_blocks;
+   std::unique_ptr<boost::asio::thread_pool> serialize_pool;
+   enum class export_mode { json, binary };
+   export_mode block_export_mode = export_mode::json;
+   bool json_stream_writer = false; ///< write_transaction_json instead of to_variant_with_abi + fc::json
+   uint32_t serialize_threads = 2;
+   uint32_t serialize_lookahead = 8;
+
+   // pipeline telemetry, histograms in ns unless noted
+   metrics_report report_metrics() const;
+   latency_histogram transaction_metadata_wait;
+   latency_histogram transaction_trace_wait;
+   latency_histogram block_state_wait;
+   latency_histogram irreversible_block_wait;
+   latency_histogram unpack_time;
+   latency_histogram abi_serialize_time;
+   latency_histogram json_encode_time;
+   std::atomic<uint32_t> last_irreversible_block{0};
+   std::atomic<size_t> pending_block_count{0};
+
+   // irreversible blocks only keep their signed_block, the block state is not needed to export them
+   struct irreversible_entry {
+      chain::signed_block_ptr block; ///< null when spilled, read back from blocks.log
+      uint32_t                block_num = 0;
+      uint64_t                charged = 0;
    };
 
-   typedef boost::multi_index_container<abi_cache,
-         indexed_by<
-               ordered_unique< tag<by_account>,  member<abi_cache,account_name,&abi_cache::account> >,
-               ordered_non_unique< tag<by_last_access>,  member<abi_cache,fc::time_point,&abi_cache::last_accessed> >
-         >
-   > abi_cache_index_t;
-
-   abi_cache_index_t abi_cache_index;
-
-   std::deque<chain::transaction_metadata_ptr> transaction_metadata_queue;
+   ingest_queue<chain::transaction_metadata_ptr> transaction_metadata_queue;
    std::deque<chain::transaction_metadata_ptr> transaction_metadata_process_queue;
-   std::deque<chain::transaction_trace_ptr> transaction_trace_queue;
-   std::deque<chain::transaction_trace_ptr> transaction_trace_process_queue;
-   std::deque<chain::block_state_ptr> block_state_queue;
-   std::deque<chain::block_state_ptr> block_state_process_queue;
-   std::deque<chain::block_state_ptr> irreversible_block_state_queue;
-   std::deque<chain::block_state_ptr> irreversible_block_state_process_queue;
+   ingest_queue<trace_entry> transaction_trace_queue;
+   std::deque<trace_entry> transaction_trace_process_queue;
+   ingest_queue<accepted_block_entry> block_state_queue;
+   std::deque<accepted_block_entry> block_state_process_queue;
+   ingest_queue<irreversible_entry> irreversible_block_state_queue;
+   std::deque<irreversible_entry> irreversible_block_state_process_queue;
+
+   // bytes of everything queued above and of messages in flight; over budget new entries are
+   // shed, downgraded or spilled per memory_policy, irreversible blocks are never shed
+   memory_budget memory;
+   memory_overflow_policy memory_policy = memory_overflow_policy::shed;
+   block_log_reader spill_reader;
+   std::atomic<uint64_t> memory_rejected{0};
+   std::atomic<uint64_t> memory_shed{0};
+   std::atomic<uint64_t> memory_downgraded{0};
+   std::atomic<uint64_t> memory_spilled{0};
+   bool admit( uint64_t bytes );
+   void export_irreversible_entry( const irreversible_entry& e );
+
+   // backfill of history from blocks.log; until it reaches the live irreversible stream the live
+   // blocks are held back, afterwards live_cursor skips live blocks it already exported and fills
+   // the ones between its last block and the first live one from the log
+   void backfill();
+   void check_backfill_handoff();
+   // reads a spilled or missing irreversible block back from blocks.log and exports it, throws if it can not
+   void export_logged_block( uint32_t block_num );
+   // an irreversible block can not be exported, stops the export and the node rather than skip it
+   void fail_export( uint32_t block_num, const std::string& reason );
+   export_cursor live_cursor;              ///< consume thread only
+   std::atomic_bool export_failed{false};
+   block_log_reader backfill_reader;
+   boost::thread backfill_thread;
+   uint32_t backfill_from = 0;
+   uint32_t backfill_threads = 4;
+   uint32_t backfill_chunk_blocks = 1024;
+   bool backfilling = false;               ///< consume thread only
+   std::atomic_bool backfill_stop{false};
+   std::atomic_bool backfill_failed{false};
+   std::atomic<uint32_t> next_backfill_block{0};
+   ingest_queue<chain::signed_block_ptr> backfill_queue;
+   std::deque<chain::signed_block_ptr> backfill_process_queue;
+   backfill_handoff<irreversible_entry> held_irreversible_blocks; ///< consume thread only
 
    std::atomic_bool done{false};
    std::atomic_bool startup{true};
+   // mtx and condition only park the consume thread when every queue is empty,
+   // producers touch them only while consumer_sleeping is set; both sides order the flag
+   // against the queue state with a seq_cst fence, so a push never misses a parked consumer
+   std::atomic_bool consumer_sleeping{false};
    boost::mutex mtx;
    boost::condition_variable condition;
-   size_t max_queue_size = 512;
-   int queue_sleep_time = 0;
-private:
-   std::unique_ptr<grpc_stub> _grpc_stub;
-   
+   size_t max_queue_size = 1024;
+   queue_overflow_policy queue_overflow = queue_overflow_policy::spill;
+   uint32_t queue_block_ms = 100;
+   uint32_t block_window = 16;
+   // batching of consecutive blocks into rpc_sendblocks, also exports empty blocks
+   uint32_t batch_max_kb = 0;
+   uint32_t batch_max_ms = 50;
+   uint32_t batch_latency_ms = 200;
 };
 
 std::string grpc_stub::PutRequest(std::string action,std::string json)
@@ -168,6 +647,7 @@ std::string grpc_stub::PutRequest(std::string action,std::string json)
     request.set_json(json);
     EosReply reply;
     ClientContext context;
+    SetDeadline(context);
     Status status = stub_->rpc_sendaction(&context, request, &reply);
     if (status.ok()) {
       return reply.message();
@@ -180,6 +660,7 @@ std::string grpc_stub::PutRequest(std::string action,std::string json)
   {
      elog( "Exception on grpc_stub PutRequest: ${e}", ("e", e.what()));
   }
+  return "RPC failed";
 }
 
 std::string grpc_stub::PutTransferRequest(std::string from,std::string to,std::string amount,std::string memo,std::string trx_id)
@@ -194,6 +675,7 @@ std::string grpc_stub::PutTransferRequest(std::string from,std::string to,std::s
 
     TransferReply reply;
     ClientContext context;
+    SetDeadline(context);
     Status status = transfer_stub_->rpc_sendaction(&context, request, &reply);
     if (status.ok()) {
       return reply.message();
@@ -206,6 +688,7 @@ std::string grpc_stub::PutTransferRequest(std::string from,std::string to,std::s
    {
      elog( "Exception on grpc_stub PutRequest: ${e}", ("e", e.what()));
    }
+   return "RPC failed";
 }
 
 std::string grpc_stub::PutTransactionRequest(int blocknum,std::string trxjson,std::string trx_id)
@@ -219,6 +702,7 @@ std::string grpc_stub::PutTransactionRequest(int blocknum,std::string trxjson,st
 
     TransactionReply reply;
     ClientContext context;
+    SetDeadline(context);
     Status status = transaction_stub_->rpc_sendaction(&context, request, &reply);
     if (status.ok()) {
       return reply.message();
@@ -231,61 +715,434 @@ std::string grpc_stub::PutTransactionRequest(int blocknum,std::string trxjson,st
    {
      elog( "Exception on grpc_stub PutRequest: ${e}", ("e", e.what()));
    }
+   return "RPC failed";
 }
 
-std::string grpc_stub::PutBlockRequest(int blocknum,vector<BlockTransRequest> &blockTrans)
+bool grpc_stub::WarmUp()
 {
-   try{
-    BlockRequest request;
-    request.set_blocknum(blocknum);
-    int nsize = blockTrans.size();
-    for (int i=0;i!=nsize;++i)
-    {
-       BlockTransRequest *blockTranstemp = request.add_trans();
-       *blockTranstemp = blockTrans[i];
-    }
-    
+  for( const auto& channel : channels_ ) {
+     if( !channel->WaitForConnected(std::chrono::system_clock::now() + policy_.deadline) )
+        return false;
+  }
+  if( PutRequest(std::string("init"),std::string("init--json")) == "RPC failed" )
+     return false;
+  breaker_.record_success();
+  ready_ = true;
+  return true;
+}
 
-    BlockReply reply;
-    ClientContext context;
-    Status status = block_stub_->rpc_sendaction(&context, request, &reply);
-    if (status.ok()) {
-      return reply.message();
-    } else {
-      std::cout << status.error_code() << ": " << status.error_message()
-                << std::endl;
-      return "RPC failed";
-    }
-   }catch(std::exception& e)
-   {
-     elog( "Exception on grpc_stub PutRequest: ${e}", ("e", e.what()));
+bool grpc_stub::Retryable(const Status& status) const
+{
+   switch( status.error_code() ) {
+      case grpc::StatusCode::UNAVAILABLE:
+      case grpc::StatusCode::DEADLINE_EXCEEDED:
+      case grpc::StatusCode::RESOURCE_EXHAUSTED:
+      case grpc::StatusCode::ABORTED:
+      case grpc::StatusCode::INTERNAL:
+         return true;
+      default:
+         return false;
+   }
+}
+
+void grpc_stub::SetBatching(uint64_t max_bytes, std::chrono::milliseconds max_delay, std::chrono::milliseconds target_latency)
+{
+   batch_max_bytes_ = max_bytes;
+   batch_min_bytes_ = std::min<uint64_t>(max_bytes, 16 * 1024);
+   // start small, like a congestion window, and grow while the server keeps up
+   batch_limit_ = std::max(batch_min_bytes_, max_bytes / 16);
+   batch_max_delay_ = max_delay;
+   batch_target_latency_ = target_latency;
+}
+
+std::unique_ptr<grpc_stub::block_call> grpc_stub::StartBlockCall(std::unique_ptr<block_call> call)
+{
+   SetDeadline(call->context);
+   if( block_compression_set_ )
+      call->context.set_compression_algorithm(block_compression_);
+   auto& block_stub = block_stubs_[next_block_stub_++ % block_stubs_.size()];
+   call->started = std::chrono::steady_clock::now();
+   if( call->batch )
+      call->reader = block_stub->PrepareAsyncrpc_sendblocks(&call->context, *call->batch, &block_cq_);
+   else
+      call->reader = block_stub->PrepareAsyncrpc_sendaction(&call->context, *call->request, &block_cq_);
+   call->reader->StartCall();
+   call->reader->Finish(&call->reply, &call->status, call.get());
+   return call;
+}
+
+void grpc_stub::PutBlockRequestAsync(arena_pool::arena_ptr arena, BlockRequest* request)
+{
+   if( batch_max_bytes_ > 0 ) {
+      AddToBatch(std::move(arena), request);
+      return;
+   }
+   std::unique_ptr<block_call> call(new block_call);
+   call->arena = std::move(arena);
+   call->request = request;
+   SendBlockCall(std::move(call));
+}
+
+void grpc_stub::SendBlockCall(std::unique_ptr<block_call> call)
+{
+   block_held_.emplace_back(std::move(call));
+   DispatchBlockCalls();
+}
+
+void grpc_stub::DispatchBlockCalls()
+{
+   ReapBlockRequests(false);
+   while( !block_held_.empty() ) {
+      if( !breaker_.allow() ) {
+         // keep the blocks until the downstream is probed again, except when shutting down
+         if( !stopping_ )
+            break;
+         for( auto& call : block_held_ ) {
+            call->status = Status(grpc::StatusCode::UNAVAILABLE, "circuit breaker open");
+            elog( "grpc block ${b} not sent, ${m}", ("b", call->blocks())("m", call->status.error_message()));
+            ReportBlockCall(*call);
+         }
+         block_held_.clear();
+         break;
+      }
+      if( block_calls_.size() >= block_window_ ) {
+         // wait for the oldest call in flight, but never for a backoff; the caller polls for that
+         if( BlockBackingOff() )
+            break;
+         ReapBlockRequests(true);
+         continue;
+      }
+      block_calls_.emplace_back(StartBlockCall(std::move(block_held_.front())));
+      block_held_.pop_front();
    }
 }
 
+void grpc_stub::AddToBatch(arena_pool::arena_ptr arena, BlockRequest* request)
+{
+   const uint32_t block_num = request->blocknum();
+   const uint64_t size = request->trans_size() == 0 ? 0 : request->ByteSizeLong();
+   if( batch_ && size > 0 && batch_->bytes + size > batch_limit_ )
+      SendBatch();
+   if( !batch_ ) {
+      batch_.reset(new block_call);
+      batch_->arena = arena;
+      batch_->batch = google::protobuf::Arena::CreateMessage<BlockBatchRequest>(arena.get());
+      batch_->batch->set_first_blocknum(block_num);
+      batch_opened_ = std::chrono::steady_clock::now();
+   }
+
+   auto& batch = *batch_->batch;
+   if( size == 0 ) {
+      // runs of empty blocks collapse into one range
+      auto* range = batch.empty_size() > 0 ? batch.mutable_empty(batch.empty_size() - 1) : nullptr;
+      if( range && range->first() + range->count() == block_num ) {
+         range->set_count(range->count() + 1);
+      } else {
+         range = batch.add_empty();
+         range->set_first(block_num);
+         range->set_count(1);
+         batch_->bytes += 2 * sizeof(uint32_t);
+      }
+   } else {
+      // blocks stay where they were built, the batch points at them and keeps their arena
+      if( arena != batch_->arena && (batch_->block_arenas.empty() || arena != batch_->block_arenas.back()) )
+         batch_->block_arenas.emplace_back(std::move(arena));
+      batch.mutable_blocks()->UnsafeArenaAddAllocated(request);
+      batch_->bytes += size;
+   }
+   batch.set_last_blocknum(block_num);
+
+   if( batch_->bytes >= batch_limit_ || std::chrono::steady_clock::now() - batch_opened_ >= batch_max_delay_ )
+      SendBatch();
+}
+
+void grpc_stub::SendBatch()
+{
+   if( batch_ )
+      SendBlockCall(std::move(batch_));
+}
+
+void grpc_stub::PollBlockRequests()
+{
+   if( batch_ && std::chrono::steady_clock::now() - batch_opened_ >= batch_max_delay_ )
+      SendBatch();
+   DispatchBlockCalls();
+}
+
+void grpc_stub::ReportBlockCall(const block_call& call)
+{
+   if( !block_callback_ )
+      return;
+   if( !call.batch ) {
+      block_callback_(*call.request, call.status);
+      return;
+   }
+   for( const auto& block : call.batch->blocks() )
+      block_callback_(block, call.status);
+   // let the callback see the end of a batch that closes with empty blocks, e.g. to ack a spool
+   const auto& blocks = call.batch->blocks();
+   if( blocks.empty() || (uint32_t)blocks.Get(blocks.size() - 1).blocknum() != call.batch->last_blocknum() ) {
+      BlockRequest last;
+      last.set_blocknum(call.batch->last_blocknum());
+      block_callback_(last, call.status);
+   }
+}
+
+void grpc_stub::AdaptBatchLimit(const block_call& call)
+{
+   const double latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - call.started).count();
+   batch_latency_ms_ = batch_latency_ms_ == 0 ? latency_ms : 0.8 * batch_latency_ms_ + 0.2 * latency_ms;
+   if( batch_latency_ms_ > batch_target_latency_.count() ) {
+      batch_limit_ = std::max(batch_limit_ / 2, batch_min_bytes_);
+   } else if( call.bytes * 2 >= batch_limit_ && batch_latency_ms_ * 2 < batch_target_latency_.count() ) {
+      // only grow on batches that were actually limited by size
+      batch_limit_ = std::min(batch_limit_ * 2, batch_max_bytes_);
+   }
+}
+
+void grpc_stub::FlushBlockRequests()
+{
+   SendBatch();
+   while( !block_held_.empty() || !block_calls_.empty() ) {
+      DispatchBlockCalls();
+      if( !block_calls_.empty() && !BlockBackingOff() )
+         ReapBlockRequests(true);
+      else if( !block_held_.empty() || !block_calls_.empty() )
+         boost::this_thread::sleep_for( boost::chrono::milliseconds( 10 ));
+   }
+}
+
+void grpc_stub::ReapBlockRequests(bool wait_front)
+{
+   void* tag = nullptr;
+   bool ok = false;
+   if( wait_front ) {
+      while( !block_calls_.empty() && !block_calls_.front()->finished ) {
+         if( !block_cq_.Next(&tag, &ok) ) return;
+         static_cast<block_call*>(tag)->finished = true;
+      }
+   } else {
+      while( block_cq_.AsyncNext(&tag, &ok, gpr_time_0(GPR_CLOCK_REALTIME)) == CompletionQueue::GOT_EVENT )
+         static_cast<block_call*>(tag)->finished = true;
+   }
+
+   // retire in send order so the server sees and we report blocks sequentially
+   while( !block_calls_.empty() && block_calls_.front()->finished ) {
+      auto& call = block_calls_.front();
+      if( !call->backing_off ) {
+         if( latency_histogram_ )
+            latency_histogram_->record_since(call->started);
+         if( call->status.ok() ) {
+            breaker_.record_success();
+            if( call->batch )
+               AdaptBatchLimit(*call);
+         } else {
+            breaker_.record_failure();
+            if( Retryable(call->status) && call->attempt < policy_.max_retries && !stopping_ ) {
+               // retry in place once the backoff is over, later blocks keep waiting behind it
+               const auto delay = policy_.backoff(call->attempt);
+               wlog( "grpc block ${b} RPC failed, ${c}: ${m}, retry ${a} in ${d} ms",
+                     ("b", call->blocks())("c", (int)call->status.error_code())("m", call->status.error_message())
+                     ("a", call->attempt + 1)("d", delay.count()));
+               call->retry_at = std::chrono::steady_clock::now() + delay;
+               call->backing_off = true;
+            }
+         }
+      }
+      if( call->backing_off && !stopping_ ) {
+         if( std::chrono::steady_clock::now() < call->retry_at || !breaker_.allow() )
+            return;
+         std::unique_ptr<block_call> retry(new block_call);
+         retry->arena = std::move(call->arena);
+         retry->block_arenas = std::move(call->block_arenas);
+         retry->request = call->request;
+         retry->batch = call->batch;
+         retry->bytes = call->bytes;
+         retry->attempt = call->attempt + 1;
+         call = StartBlockCall(std::move(retry));
+         continue;
+      }
+      if( !call->status.ok() )
+         elog( "grpc block ${b} RPC failed, ${c}: ${m}",
+               ("b", call->blocks())("c", (int)call->status.error_code())("m", call->status.error_message()));
+      ReportBlockCall(*call);
+      block_calls_.pop_front();
+   }
+}
+
+template<typename Request, typename Reply>
+grpc_stub::call_window<Request, Reply>::~call_window()
+{
+   void* tag = nullptr;
+   bool ok = false;
+   cq_.Shutdown();
+   while( cq_.Next(&tag, &ok) ) {}
+}
+
+template<typename Request, typename Reply>
+std::unique_ptr<typename grpc_stub::call_window<Request, Reply>::call> grpc_stub::call_window<Request, Reply>::Start(std::unique_ptr<call> c)
+{
+   stub_.SetDeadline(c->context);
+   if( stub_.block_compression_set_ )
+      c->context.set_compression_algorithm(stub_.block_compression_);
+   c->reader = prepare_(&c->context, c->request, &cq_);
+   c->reader->StartCall();
+   c->reader->Finish(&c->reply, &c->status, c.get());
+   return c;
+}
+
+template<typename Request, typename Reply>
+void grpc_stub::call_window<Request, Reply>::Put(Request&& request)
+{
+   std::unique_ptr<call> c(new call);
+   c->request = std::move(request);
+   held_.emplace_back(std::move(c));
+   Dispatch();
+}
+
+template<typename Request, typename Reply>
+void grpc_stub::call_window<Request, Reply>::Dispatch()
+{
+   Reap(false);
+   while( !held_.empty() ) {
+      if( calls_.size() >= stub_.block_window_ ) {
+         if( BackingOff() )
+            break;
+         Reap(true);
+         continue;
+      }
+      calls_.emplace_back(Start(std::move(held_.front())));
+      held_.pop_front();
+   }
+}
+
+template<typename Request, typename Reply>
+void grpc_stub::call_window<Request, Reply>::Flush()
+{
+   while( !held_.empty() || !calls_.empty() ) {
+      Dispatch();
+      if( !calls_.empty() && !BackingOff() )
+         Reap(true);
+      else if( !held_.empty() || !calls_.empty() )
+         boost::this_thread::sleep_for( boost::chrono::milliseconds( 10 ));
+   }
+}
+
+template<typename Request, typename Reply>
+void grpc_stub::call_window<Request, Reply>::Reap(bool wait_front)
+{
+   void* tag = nullptr;
+   bool ok = false;
+   if( wait_front ) {
+      while( !calls_.empty() && !calls_.front()->finished ) {
+         if( !cq_.Next(&tag, &ok) ) return;
+         static_cast<call*>(tag)->finished = true;
+      }
+   } else {
+      while( cq_.AsyncNext(&tag, &ok, gpr_time_0(GPR_CLOCK_REALTIME)) == CompletionQueue::GOT_EVENT )
+         static_cast<call*>(tag)->finished = true;
+   }
+   while( !calls_.empty() && calls_.front()->finished ) {
+      auto& c = calls_.front();
+      const auto& policy = stub_.policy_;
+      if( !c->status.ok() && !c->backing_off && stub_.Retryable(c->status) && c->attempt < policy.max_retries && !stub_.stopping_ ) {
+         const auto delay = policy.backoff(c->attempt);
+         wlog( "grpc ${w} ${b} RPC failed, ${c}: ${m}, retry ${a} in ${d} ms",
+               ("w", what_)("b", call_label(c->request))("c", (int)c->status.error_code())("m", c->status.error_message())
+               ("a", c->attempt + 1)("d", delay.count()));
+         c->retry_at = std::chrono::steady_clock::now() + delay;
+         c->backing_off = true;
+      }
+      if( c->backing_off && !stub_.stopping_ ) {
+         if( std::chrono::steady_clock::now() < c->retry_at )
+            return;
+         std::unique_ptr<call> retry(new call);
+         retry->request.Swap(&c->request);
+         retry->attempt = c->attempt + 1;
+         c = Start(std::move(retry));
+         continue;
+      }
+      if( !c->status.ok() )
+         elog( "grpc ${w} ${b} RPC failed, ${c}: ${m}",
+               ("w", what_)("b", call_label(c->request))("c", (int)c->status.error_code())("m", c->status.error_message()));
+      calls_.pop_front();
+   }
+}
+
+grpc_stub::~grpc_stub()
+{
+   try {
+      FlushBlockRequests();
+      FlushTransferRequests();
+      FlushTraceRequests();
+      FlushHeadEvents();
+   } catch(std::exception& e) {
+      elog( "Exception on grpc_stub flush: ${e}", ("e", e.what()));
+   }
+   void* tag = nullptr;
+   bool ok = false;
+   block_cq_.Shutdown();
+   while( block_cq_.Next(&tag, &ok) ) {}
+}
+
 template<typename Queue, typename Entry>
-void grpc_client_plugin_impl::queue( Queue& queue, const Entry& e ) {
-   boost::mutex::scoped_lock lock( mtx );
-   auto queue_size = queue.size();
-   if( queue_size > max_queue_size ) {
-      lock.unlock();
+bool grpc_client_plugin_impl::queue( Queue& queue, const Entry& e ) {
+   const bool pushed = queue.push( e );
+   if( !pushed ) {
+      // log on powers of two so a dropping chain thread does not also flood the log
+      const auto dropped = queue.dropped_count();
+      if( (dropped & (dropped - 1)) == 0 )
+         wlog("grpc_client queue full, dropped ${d} entries so far", ("d", dropped));
+   }
+   wake_consumer();
+   return pushed;
+}
+
+bool grpc_client_plugin_impl::admit( uint64_t bytes ) {
+   if( memory.try_charge( bytes ))
+      return true;
+   // log on powers of two like queue overflows
+   const auto rejected = ++memory_rejected;
+   if( (rejected & (rejected - 1)) == 0 )
+      wlog("grpc_client memory budget of ${b} bytes exceeded, ${r} entries over it so far", ("b", memory.limit())("r", rejected));
+   return false;
+}
+
+void grpc_client_plugin_impl::wake_consumer() {
+   // pairs with the fence in consume_blocks: either the consumer sees the entry pushed before
+   // this call, or this call sees it sleeping and notifies it under the mutex
+   std::atomic_thread_fence( std::memory_order_seq_cst );
+   if( consumer_sleeping.load( std::memory_order_relaxed )) {
+      boost::mutex::scoped_lock lock( mtx );
       condition.notify_one();
-      queue_sleep_time += 10;
-      if( queue_sleep_time > 1000 )
-         wlog("queue size: ${q}", ("q", queue_size));
-      boost::this_thread::sleep_for( boost::chrono::milliseconds( queue_sleep_time ));
-      lock.lock();
-   } else {
-      queue_sleep_time -= 10;
-      if( queue_sleep_time < 0 ) queue_sleep_time = 0;
    }
-   queue.emplace_back( e );
-   lock.unlock();
-   condition.notify_one();
+}
+
+bool grpc_client_plugin_impl::backlogs_empty() const {
+   return backfill_process_queue.empty() &&
+          transaction_metadata_process_queue.empty() &&
+          transaction_trace_process_queue.empty() &&
+          block_state_process_queue.empty() &&
+          irreversible_block_state_process_queue.empty();
+}
+
+bool grpc_client_plugin_impl::queues_empty() const {
+   return backfill_queue.empty() &&
+          transaction_metadata_queue.empty() &&
+          transaction_trace_queue.empty() &&
+          block_state_queue.empty() &&
+          irreversible_block_state_queue.empty();
 }
 
 void grpc_client_plugin_impl::accepted_transaction( const chain::transaction_metadata_ptr& t ) {
    try {
-         queue( transaction_metadata_queue, t );
+         const auto size = approx_size( *t );
+         if( !admit( size )) {
+            ++memory_shed;
+            return;
+         }
+         if( !queue( transaction_metadata_queue, t ))
+            memory.release( size );
    } catch (fc::exception& e) {
       elog("FC Exception while accepted_transaction ${e}", ("e", e.to_string()));
    } catch (std::exception& e) {
@@ -297,8 +1154,14 @@ void grpc_client_plugin_impl::accepted_transaction( const chain::transaction_met
 
 void grpc_client_plugin_impl::applied_transaction( const chain::transaction_trace_ptr& t ) {
    try {
-      // always queue since account information always gathered
-      queue( transaction_trace_queue, t );
+      // only connected with the trace stream
+      const auto size = approx_size( *t );
+      if( !admit( size )) {
+         ++memory_shed;
+         return;
+      }
+      if( !queue( transaction_trace_queue, trace_entry{ t, chain::block_state_ptr(), size } ))
+         memory.release( size );
    } catch (fc::exception& e) {
       elog("FC Exception while applied_transaction ${e}", ("e", e.to_string()));
    } catch (std::exception& e) {
@@ -310,7 +1173,20 @@ void grpc_client_plugin_impl::applied_transaction( const chain::transaction_trac
 
 void grpc_client_plugin_impl::applied_irreversible_block( const chain::block_state_ptr& bs ) {
    try {
-         queue( irreversible_block_state_queue, bs );
+         last_irreversible_block = bs->block_num;
+         irreversible_entry e{ bs->block, bs->block_num, approx_size( *bs->block ) };
+         if( memory_policy != memory_overflow_policy::spill ) {
+            memory.charge( e.charged ); // the export needs every block, never shed
+         } else if( !admit( e.charged )) {
+            e.block.reset();
+            e.charged = 0;
+            ++memory_spilled;
+         }
+         // the queue always spills, a block it still refuses leaves a hole no later signal fills
+         if( !queue( irreversible_block_state_queue, e )) {
+            memory.release( e.charged );
+            fail_export( bs->block_num, "the irreversible block queue refused it" );
+         }
    } catch (fc::exception& e) {
       elog("FC Exception while applied_irreversible_block ${e}", ("e", e.to_string()));
    } catch (std::exception& e) {
@@ -322,7 +1198,26 @@ void grpc_client_plugin_impl::applied_irreversible_block( const chain::block_sta
 
 void grpc_client_plugin_impl::accepted_block( const chain::block_state_ptr& bs ) {
    try {
-         queue( block_state_queue, bs );
+         if( head_stream ) {
+            accepted_block_entry e{ bs, head_block{ bs->block_num, bs->id, bs->header.previous }, bs->dpos_irreversible_blocknum,
+                                    bs->header.timestamp, bs->header.producer, approx_size( *bs ) };
+            bool keep = true;
+            if( !admit( e.charged )) {
+               keep = memory_policy != memory_overflow_policy::shed;
+               e.bs.reset();
+               e.charged = 0;
+               ++(keep ? memory_downgraded : memory_shed);
+            }
+            if( keep && !queue( block_state_queue, e ))
+               memory.release( e.charged );
+         }
+         if( trace_stream ) {
+            // the block marker closes the traces applied before it, never shed
+            const auto size = approx_size( *bs );
+            memory.charge( size );
+            if( !queue( transaction_trace_queue, trace_entry{ chain::transaction_trace_ptr(), bs, size } ))
+               memory.release( size );
+         }
    } catch (fc::exception& e) {
       elog("FC Exception while accepted_block ${e}", ("e", e.to_string()));
    } catch (std::exception& e) {
@@ -349,10 +1244,16 @@ void grpc_client_plugin_impl::process_accepted_transaction( const chain::transac
 
 void grpc_client_plugin_impl::process_applied_transaction( const chain::transaction_trace_ptr& t ) {
    try {
-      // always call since we need to capture setabi on accounts even if not storing transaction traces
-      // auto json = fc::json::to_string(t.trace).c_str();
-      // std::string action = std::string("process_applied_transaction");
-      // auto reply = _grpc_stub->PutRequest(action,json);
+      if( t->action_traces.size() == 1 && t->action_traces.front().act.account == chain::config::system_account_name &&
+          t->action_traces.front().act.name == N(onblock) ) {
+         // the implicit onblock transaction has no receipt in the block, the last one applied is the block's
+         onblock_trace = t;
+         return;
+      }
+      auto& slot = block_traces[t->id];
+      if( slot )
+         ++traces_dropped;
+      slot = t;
    } catch (fc::exception& e) {
       elog("FC Exception while processing applied transaction trace: ${e}", ("e", e.to_detail_string()));
    } catch (std::exception& e) {
@@ -362,9 +1263,77 @@ void grpc_client_plugin_impl::process_applied_transaction( const chain::transact
    }
 }
 
-void grpc_client_plugin_impl::process_irreversible_block(const chain::block_state_ptr& bs) {
+void grpc_client_plugin_impl::process_trace_block( const chain::block_state_ptr& bs ) {
+   try {
+      BlockTraces request;
+      request.set_blocknum( bs->block_num );
+      request.set_block_id( bs->id.data(), bs->id.data_size() );
+      request.set_previous( bs->header.previous.data(), bs->header.previous.data_size() );
+      if( onblock_trace )
+         fill_transaction_trace( *onblock_trace, *request.add_traces() );
+      for( const auto& receipt : bs->block->transactions ) {
+         auto itr = block_traces.find( receipt_id( receipt ));
+         if( itr == block_traces.end() )
+            continue;
+         fill_transaction_trace( *itr->second, *request.add_traces() );
+         block_traces.erase( itr );
+      }
+      traces_sent += request.traces_size();
+      traces_dropped += block_traces.size();
+      partitions.front()->stub->PutTraceRequestAsync( std::move( request ));
+   } catch (fc::exception& e) {
+      elog("FC Exception while processing traces of block ${b}: ${e}", ("b", bs->block_num)("e", e.to_detail_string()));
+   } catch (std::exception& e) {
+      elog("STD Exception while processing traces of block ${b}: ${e}", ("b", bs->block_num)("e", e.what()));
+   } catch (...) {
+      elog("Unknown exception while processing traces of block ${b}", ("b", bs->block_num));
+   }
+   block_traces.clear();
+   onblock_trace.reset();
+}
+
+void grpc_client_plugin_impl::fill_transaction_trace( const chain::transaction_trace& trace, TransactionTrace& out ) {
+   out.set_id( trace.id.data(), trace.id.data_size() );
+   if( trace.receipt ) {
+      out.set_status( static_cast<uint32_t>( trace.receipt->status.value ));
+      out.set_cpu_usage_us( trace.receipt->cpu_usage_us );
+      out.set_net_usage_words( trace.receipt->net_usage_words.value );
+   }
+   out.set_elapsed_us( trace.elapsed.count() );
+   out.set_net_usage( trace.net_usage );
+   out.set_scheduled( trace.scheduled );
+   for( const auto& atrace : trace.action_traces )
+      fill_action_trace( atrace, *out.add_action_traces() );
+   if( trace.except )
+      out.set_except( fc::prune_invalid_utf8( trace.except->to_string() ));
+}
+
+void grpc_client_plugin_impl::fill_action_trace( const chain::action_trace& atrace, ActionTrace& out ) {
+   const auto& act = atrace.act;
+   out.set_receiver( atrace.receipt.receiver.value );
+   out.set_account( act.account.value );
+   out.set_name( act.name.value );
+   for( const auto& auth : act.authorization ) {
+      auto* level = out.add_authorization();
+      level->set_actor( auth.actor.value );
+      level->set_permission( auth.permission.value );
+   }
+   out.set_data( act.data.data(), act.data.size() );
+   out.set_global_sequence( atrace.receipt.global_sequence );
+   out.set_recv_sequence( atrace.receipt.recv_sequence );
+   out.set_elapsed_us( atrace.elapsed.count() );
+   // contracts print whatever they like, proto3 strings must be utf8
+   if( fc::is_utf8( atrace.console ))
+      out.set_console( atrace.console );
+   else
+      out.set_console( fc::prune_invalid_utf8( atrace.console ));
+   for( const auto& inline_trace : atrace.inline_traces )
+      fill_action_trace( inline_trace, *out.add_inline_traces() );
+}
+
+void grpc_client_plugin_impl::process_irreversible_block(const chain::signed_block_ptr& block) {
   try {
-        _process_irreversible_block( bs );
+        _process_irreversible_block( block );
   } catch (fc::exception& e) {
      elog("FC Exception while processing irreversible block: ${e}", ("e", e.to_detail_string()));
   } catch (std::exception& e) {
@@ -374,54 +1343,300 @@ void grpc_client_plugin_impl::process_irreversible_block(const chain::block_stat
   }
 }
 
-void grpc_client_plugin_impl::_process_irreversible_block(const chain::block_state_ptr& bs) {
-      const auto block_num = bs->block->block_num();
-      bool transactions_in_block = false;
-      vector<BlockTransRequest> blockTans;
-      bool HasTransaction = false;
-      for( const auto& receipt : bs->block->transactions ) {
-         string trx_id_str;
+void grpc_client_plugin_impl::serialize_transaction(const chain::transaction_receipt& receipt, BlockTransRequest& out, uint32_t& partition,
+                                                    std::vector<TransferRequest>* transfers) {
+   // get id via get_raw_transaction() as packed_transaction.id() mutates internal transaction state
+   auto start = std::chrono::steady_clock::now();
+   const auto& raw = receipt.trx.get<packed_transaction>().get_raw_transaction();
+   const auto& trx = fc::raw::unpack<transaction>( raw );
+   unpack_time.record_since( start );
+   if( !transaction_filter.empty() && !transaction_filter.accept( trx )) {
+      partition = filtered_partition;
+      return;
+   }
+   partition = partition_of( trx );
+
+   const auto& id = trx.id();
+   out.set_trxid( id.str() );
+   if( transfers )
+      collect_transfers( trx, out.trxid(), *transfers );
+
+   start = std::chrono::steady_clock::now();
+   if( json_stream_writer ) {
+      // one buffer per serialize thread, it keeps its capacity across transactions
+      thread_local json_buffer buffer;
+      buffer.clear();
+      write_transaction_json( buffer, trx, [&]( account_name n ) { return get_abi_serializer( n ); }, abi_serializer_max_time );
+      json_encode_time.record_since( start );
+      out.set_trx( buffer.str() );
+      return;
+   }
+   auto v = to_variant_with_abi( trx );
+   abi_serialize_time.record_since( start );
+   start = std::chrono::steady_clock::now();
+   out.set_trx( fc::json::to_string( v ) );
+   json_encode_time.record_since( start );
+}
+
+uint32_t grpc_client_plugin_impl::partition_of( const transaction& trx ) const {
+   if( partitions.size() < 2 || partition_by == partition_mode::block || trx.actions.empty() )
+      return 0;
+   // the first action decides, so every transaction of an account lands on the same consumer
+   const auto& act = trx.actions.front();
+   uint64_t key = act.account.value;
+   if( partition_by == partition_mode::actor && !act.authorization.empty() )
+      key = act.authorization.front().actor.value;
+   return ((key * 0x9E3779B97F4A7C15ull) >> 32) % partitions.size();
+}
+
+void grpc_client_plugin_impl::collect_transfers( const transaction& trx, const std::string& trx_id, std::vector<TransferRequest>& out ) {
+   for( const auto& act : trx.actions ) {
+      try {
+         TransferRequest request;
+         if( !hot_actions::build_transfer_request( act, request )) {
+            // no generated decoder, fall back to the contract abi
+            if( act.name != N(transfer) )
+               continue;
+            auto abi = get_abi_serializer( act.account );
+            if( !abi.valid() )
+               continue;
+            const auto type = abi->get_action_type( act.name );
+            if( type.empty() )
+               continue;
+            const auto v = abi->binary_to_variant( type, act.data, abi_serializer_max_time );
+            const auto& data = v.get_object();
+            if( !data.contains( "from" ) || !data.contains( "to" ) || !data.contains( "quantity" ) || !data.contains( "memo" ))
+               continue;
+            request.set_from( data["from"].as_string() );
+            request.set_to( data["to"].as_string() );
+            request.set_amount( data["quantity"].as_string() );
+            request.set_memo( data["memo"].as_string() );
+         }
+         request.set_trxid( trx_id );
+         out.emplace_back( std::move( request ));
+      } FC_LOG_AND_DROP()
+   }
+}
 
+void grpc_client_plugin_impl::pack_transaction(const chain::transaction_receipt& receipt, BlockTransRequest& out, uint32_t& partition,
+                                               std::vector<TransferRequest>* transfers) {
+   const auto& pt = receipt.trx.get<packed_transaction>();
+   fc::optional<transaction> trx;
+   if( !transaction_filter.empty() || transfers || (partitions.size() > 1 && partition_by != partition_mode::block) ) {
+      const auto start = std::chrono::steady_clock::now();
+      trx = fc::raw::unpack<transaction>( pt.get_raw_transaction() );
+      unpack_time.record_since( start );
+      if( !transaction_filter.empty() && !transaction_filter.accept( *trx )) {
+         partition = filtered_partition;
+         return;
+      }
+   }
+   const auto id = fill_packed_transaction( receipt, out );
+   partition = trx ? partition_of( *trx ) : 0;
+   if( transfers )
+      collect_transfers( *trx, id.str(), *transfers );
+}
 
+void grpc_client_plugin_impl::_process_irreversible_block(const chain::signed_block_ptr& block) {
+      std::unique_ptr<pending_block> pb(new pending_block);
+      pb->block = block;
+      pb->arena = message_arenas.get();
+      pb->request = google::protobuf::Arena::CreateMessage<BlockRequest>( pb->arena.get() );
+      pb->request->set_blocknum( block->block_num() );
+
+      struct work_item {
+         const chain::transaction_receipt* receipt;
+         BlockTransRequest*               out;
+         uint32_t*                        partition;
+         std::vector<TransferRequest>*    transfers;
+      };
+      vector<work_item> work;
+      size_t trx_count = 0;
+      for( const auto& receipt : block->transactions ) {
+         if( receipt.trx.contains<packed_transaction>() )
+            ++trx_count;
+      }
+      // sized up front so the workers can keep pointers into it
+      pb->trans_partition.resize( trx_count );
+      if( transfer_stream )
+         pb->transfers.resize( trx_count );
+      for( const auto& receipt : block->transactions ) {
          // bool executed = receipt->status == chain::transaction_receipt_header::executed;
          // if (!executed) {
          //    continue ;
          // }
          if( receipt.trx.contains<packed_transaction>() ) {
-            const auto& pt = receipt.trx.get<packed_transaction>();
-            // get id via get_raw_transaction() as packed_transaction.id() mutates internal transaction state
-            const auto& raw = pt.get_raw_transaction();
-            const auto& trx = fc::raw::unpack<transaction>( raw );
-
-            const auto& id = trx.id();
-            trx_id_str = id.str();
-
-            auto v = to_variant_with_abi( trx );
-            string trx_json = fc::json::to_string( v );
-            //将transaction的信息发过去  block的信息额外再添加
-           // auto reply = _grpc_stub->PutTransactionRequest(block_num,trx_json,trx_id_str);
-
-            BlockTransRequest tempBlockTrans;
-            tempBlockTrans.set_trx(trx_json);
-            tempBlockTrans.set_trxid(trx_id_str);
-            blockTans.push_back(tempBlockTrans);
-            HasTransaction = true;
-           
-         } else {
-            const auto& id = receipt.trx.get<transaction_id_type>();
-            trx_id_str = id.str();
+            // abis are learned here in block order, the workers only read the cache; abis are
+            // used by the json export and the transfer stream, with traces they are already learned
+            if( !trace_stream && (block_export_mode == export_mode::json || transfer_stream) &&
+                receipt.status == chain::transaction_receipt_header::executed )
+               learn_abi( receipt.trx.get<packed_transaction>() );
+            uint32_t* partition = &pb->trans_partition[pb->request->trans_size()];
+            std::vector<TransferRequest>* transfers = nullptr;
+            if( transfer_stream && receipt.status == chain::transaction_receipt_header::executed )
+               transfers = &pb->transfers[pb->request->trans_size()];
+            if( block_export_mode == export_mode::binary ) {
+               // no abi_serializer involved, cheap enough to do on the consume thread
+               pack_transaction( receipt, *pb->request->add_trans(), *partition, transfers );
+               continue;
+            }
+            // slots are added here so the workers only fill them and the original order is kept
+            work.push_back( work_item{ &receipt, pb->request->add_trans(), partition, transfers } );
          }
+      }
 
+      if( !work.empty() ) {
+         // one part per worker; consecutive blocks are spread over the pool as well
+         const size_t threads = std::max<size_t>( serialize_threads, 1 );
+         const size_t chunk = (work.size() + threads - 1) / threads;
+         for( size_t begin = 0; begin < work.size(); begin += chunk ) {
+            const size_t end = std::min( begin + chunk, work.size() );
+            auto part = std::make_shared<std::packaged_task<void()>>(
+                  [this, items = decltype(work)( work.begin() + begin, work.begin() + end )]() {
+                     for( const auto& item : items )
+                        serialize_transaction( *item.receipt, *item.out, *item.partition, item.transfers );
+                  } );
+            pb->parts.emplace_back( part->get_future() );
+            if( serialize_pool )
+               boost::asio::post( *serialize_pool, [part]() { (*part)(); } );
+            else
+               (*part)();
+         }
       }
-      if (HasTransaction)
-         auto reply = _grpc_stub->PutBlockRequest(block_num,blockTans);
 
+      pending_blocks.emplace_back( std::move( pb ));
+      pending_block_count = pending_blocks.size();
+}
+
+void grpc_client_plugin_impl::send_pending_blocks(size_t keep) {
+   auto is_ready = []( const pending_block& pb ) {
+      for( const auto& part : pb.parts ) {
+         if( part.wait_for( std::chrono::seconds( 0 )) != std::future_status::ready )
+            return false;
+      }
+      return true;
+   };
 
+   while( !pending_blocks.empty() && (pending_blocks.size() > keep || is_ready( *pending_blocks.front() ))) {
+      std::unique_ptr<pending_block> pb = std::move( pending_blocks.front() );
+      pending_blocks.pop_front();
+      pending_block_count = pending_blocks.size();
+      // every part writes into pb->request, so let all of them finish before a failure drops it
+      for( auto& part : pb->parts )
+         part.wait();
+      try {
+         for( auto& part : pb->parts )
+            part.get();
+         if( !transaction_filter.empty() ) {
+            // compact the surviving transactions to the front, keeping their order
+            int kept = 0;
+            for( int i = 0; i < pb->request->trans_size(); ++i ) {
+               if( pb->trans_partition[i] == filtered_partition )
+                  continue;
+               if( kept != i ) {
+                  pb->request->mutable_trans( kept )->Swap( pb->request->mutable_trans( i ));
+                  pb->trans_partition[kept] = pb->trans_partition[i];
+               }
+               ++kept;
+            }
+            while( pb->request->trans_size() > kept )
+               pb->request->mutable_trans()->RemoveLast();
+            pb->trans_partition.resize( kept );
+         }
+         for( auto& trx_transfers : pb->transfers ) {
+            for( auto& transfer : trx_transfers )
+               partitions.front()->stub->PutTransferRequestAsync( std::move( transfer ));
+         }
+         // without batching empty blocks are skipped, batches carry them as compact ranges
+         const bool batching = batch_max_kb > 0;
+         if( pb->request->trans_size() == 0 && !batching ) {
+            continue;
+         } else if( partitions.size() == 1 ) {
+            export_block( *partitions.front(), pb->arena, pb->request );
+         } else if( partition_by == partition_mode::block ) {
+            // an empty block does not take a turn, it extends the empty range of the partition before it
+            if( pb->request->trans_size() > 0 )
+               last_block_partition = next_block_partition++ % partitions.size();
+            export_block( *partitions[last_block_partition], pb->arena, pb->request );
+         } else {
+            // split by account on the same arena, so swapping the entries over is a pointer swap
+            std::vector<BlockRequest*> split( partitions.size() );
+            for( auto& r : split )
+               r = google::protobuf::Arena::CreateMessage<BlockRequest>( pb->arena.get() );
+            for( int i = 0; i < pb->request->trans_size(); ++i )
+               split[pb->trans_partition[i]]->add_trans()->Swap( pb->request->mutable_trans( i ));
+            for( size_t i = 0; i < split.size(); ++i ) {
+               if( split[i]->trans_size() == 0 && !batching )
+                  continue;
+               split[i]->set_blocknum( pb->request->blocknum() );
+               export_block( *partitions[i], pb->arena, split[i] );
+            }
+         }
+      } catch (fc::exception& e) {
+         elog("FC Exception while serializing irreversible block ${b}: ${e}", ("b", pb->request->blocknum())("e", e.to_detail_string()));
+      } catch (std::exception& e) {
+         elog("STD Exception while serializing irreversible block ${b}: ${e}", ("b", pb->request->blocknum())("e", e.what()));
+      } catch (...) {
+         elog("Unknown exception while serializing irreversible block ${b}", ("b", pb->request->blocknum()));
+      }
+   }
+}
+
+void grpc_client_plugin_impl::export_block( export_partition& p, const arena_pool::arena_ptr& arena, BlockRequest* request ) {
+   if( p.spool )
+      p.spool->append( request->blocknum(), request->SerializeAsString() );
+   else
+      p.stub->PutBlockRequestAsync( arena, request );
+}
+
+void grpc_client_plugin_impl::send_spooled_blocks( export_partition& p ) {
+   try {
+      uint32_t block_num = 0;
+      std::string payload;
+      while( !sender_done ) {
+         if( p.send_failed ) {
+            // acks arrive in send order; after a failure the rest of the window is ignored and
+            // sending restarts right after the last acknowledged block
+            p.stub->FlushBlockRequests();
+            boost::this_thread::sleep_for( boost::chrono::seconds( 1 ));
+            p.spool->rewind();
+            p.send_failed = false;
+            continue;
+         }
+         if( !p.stub->Ready() || !p.stub->Allow() ) {
+            // keep blocks on disk until the downstream is reachable again
+            p.stub->PollBlockRequests();
+            boost::this_thread::sleep_for( boost::chrono::milliseconds( 100 ));
+            continue;
+         }
+         if( !p.spool->read_next( block_num, payload, std::chrono::milliseconds( batch_max_kb > 0 ? std::min<uint32_t>( batch_max_ms, 100 ) : 100 ))) {
+            p.stub->PollBlockRequests();
+            continue;
+         }
+         auto arena = message_arenas.get();
+         auto* request = google::protobuf::Arena::CreateMessage<BlockRequest>( arena.get() );
+         if( !request->ParseFromString( payload )) {
+            elog( "grpc_client skipping unreadable spooled block ${b}", ("b", block_num) );
+            continue;
+         }
+         p.stub->PutBlockRequestAsync( std::move( arena ), request );
+      }
+      // whatever is left stays in the spool for the next start
+      p.stub->FlushBlockRequests();
+      ilog("grpc_client sender thread ${a} shutdown gracefully, acknowledged up to block ${b}", ("a", p.address)("b", p.spool->last_acked_block()));
+   } catch (fc::exception& e) {
+      elog("FC Exception while sending spooled blocks ${e}", ("e", e.to_string()));
+   } catch (std::exception& e) {
+      elog("STD Exception while sending spooled blocks ${e}", ("e", e.what()));
+   } catch (...) {
+      elog("Unknown exception while sending spooled blocks");
+   }
 }
 
-void grpc_client_plugin_impl::process_accepted_block( const chain::block_state_ptr& bs ) {
+void grpc_client_plugin_impl::process_accepted_block( const accepted_block_entry& e ) {
    try {
-         //_process_accepted_block( bs );
+         if( head_stream )
+            _process_accepted_block( e );
    } catch (fc::exception& e) {
       elog("FC Exception while processing accepted block trace ${e}", ("e", e.to_string()));
    } catch (std::exception& e) {
@@ -431,83 +1646,233 @@ void grpc_client_plugin_impl::process_accepted_block( const chain::block_state_p
    }
 }
 
-void grpc_client_plugin_impl::consume_blocks() {
-   try {
-      //insert_default_abi();
-      while (true) {
-         boost::mutex::scoped_lock lock(mtx);
-         while ( transaction_metadata_queue.empty() &&
-                 transaction_trace_queue.empty() &&
-                 block_state_queue.empty() &&
-                 irreversible_block_state_queue.empty() &&
-                 !done ) {
-            condition.wait(lock);
-         }
+void grpc_client_plugin_impl::_process_accepted_block( const accepted_block_entry& e ) {
+   const uint32_t irreversible = e.irreversible;
+   const head_block& block = e.block;
+
+   // a block that does not extend the exported head means a fork switch; undo down to its parent
+   auto parent = head_blocks.rbegin();
+   while( parent != head_blocks.rend() && parent->id != block.previous )
+      ++parent;
+   if( parent == head_blocks.rend() ) {
+      // parent never exported, at startup or after the block queue dropped entries
+      if( !head_blocks.empty() )
+         wlog( "grpc_client head stream has no parent of block ${b}, continuing from it", ("b", block.blocknum) );
+      head_blocks.clear();
+   } else {
+      while( head_blocks.back().id != block.previous ) {
+         send_head_event( HeadBlockEvent::UNDO, head_blocks.back(), irreversible, HeadBlockEvent() );
+         head_blocks.pop_back();
+         ++head_blocks_undone;
+      }
+   }
 
-         // capture for processing
-         size_t transaction_metadata_size = transaction_metadata_queue.size();
-         if (transaction_metadata_size > 0) {
-            transaction_metadata_process_queue = move(transaction_metadata_queue);
-            transaction_metadata_queue.clear();
-         }
-         size_t transaction_trace_size = transaction_trace_queue.size();
-         if (transaction_trace_size > 0) {
-            transaction_trace_process_queue = move(transaction_trace_queue);
-            transaction_trace_queue.clear();
-         }
-         size_t block_state_size = block_state_queue.size();
-         if (block_state_size > 0) {
-            block_state_process_queue = move(block_state_queue);
-            block_state_queue.clear();
-         }
-         size_t irreversible_block_size = irreversible_block_state_queue.size();
-         if (irreversible_block_size > 0) {
-            irreversible_block_state_process_queue = move(irreversible_block_state_queue);
-            irreversible_block_state_queue.clear();
-         }
+   HeadBlockEvent event;
+   event.set_timestamp_ms( e.timestamp.to_time_point().time_since_epoch().count() / 1000 );
+   event.set_producer( e.producer.value );
+   // a downgraded entry goes out without its transactions
+   static const std::vector<chain::transaction_receipt> no_transactions;
+   for( const auto& receipt : e.bs ? e.bs->block->transactions : no_transactions ) {
+      if( !receipt.trx.contains<packed_transaction>() )
+         continue;
+      if( !transaction_filter.empty() ) {
+         const auto trx = fc::raw::unpack<transaction>( receipt.trx.get<packed_transaction>().get_raw_transaction() );
+         if( !transaction_filter.accept( trx ))
+            continue;
+      }
+      fill_packed_transaction( receipt, *event.add_trans() );
+   }
+   send_head_event( HeadBlockEvent::APPLY, block, irreversible, std::move( event ));
+   head_blocks.push_back( block );
+   last_head_block = block.blocknum;
 
-         lock.unlock();
+   // irreversible blocks are never undone, keep the last one as the anchor of the next block
+   while( head_blocks.size() > 1 && head_blocks[1].blocknum <= irreversible )
+      head_blocks.pop_front();
+}
 
-         if (done) {
-            ilog("draining queue, size: ${q}", ("q", transaction_metadata_size + transaction_trace_size + block_state_size + irreversible_block_size));
+void grpc_client_plugin_impl::send_head_event( HeadBlockEvent::Kind kind, const head_block& b, uint32_t irreversible, HeadBlockEvent&& event ) {
+   event.set_kind( kind );
+   event.set_blocknum( b.blocknum );
+   event.set_block_id( b.id.data(), b.id.data_size() );
+   event.set_previous( b.previous.data(), b.previous.data_size() );
+   event.set_irreversible_blocknum( irreversible );
+   partitions.front()->stub->PutHeadEventAsync( std::move( event ));
+}
+
+void grpc_client_plugin_impl::drain_queues() {
+   // a stream is only drained once its backlog is done, so a slow stream keeps its ingest queue
+   // full and the overflow policy applies as before
+   if( transaction_trace_process_queue.empty() ) {
+      transaction_trace_queue.drain(transaction_trace_process_queue);
+      // traces see setabi as soon as it is applied, inline ones included; learn it now as
+      // irreversible blocks may be exported before the traces get their turn
+      for( const auto& e : transaction_trace_process_queue ) {
+         if( e.trace && e.trace->receipt && e.trace->receipt->status == chain::transaction_receipt_header::executed ) {
+            for( const auto& atrace : e.trace->action_traces )
+               learn_abi( atrace );
          }
+      }
+   }
+   if( transaction_metadata_process_queue.empty() )
+      transaction_metadata_queue.drain(transaction_metadata_process_queue);
+   if( block_state_process_queue.empty() )
+      block_state_queue.drain(block_state_process_queue);
+   backfill_queue.drain(backfill_process_queue);
+   irreversible_block_state_queue.drain(irreversible_block_state_process_queue);
+}
 
-         // process applied transactions
-         while (!transaction_trace_process_queue.empty()) {
-            const auto& t = transaction_trace_process_queue.front();
-            process_applied_transaction(t);
-            transaction_trace_process_queue.pop_front();
+void grpc_client_plugin_impl::export_irreversible() {
+   drain_queues();
+
+   // backfilled blocks go through the same pipeline, strictly in order
+   while (!backfill_process_queue.empty()) {
+      const auto& block = backfill_process_queue.front();
+      if( backfilling && !export_failed && block->block_num() == next_backfill_block ) {
+         process_irreversible_block(block);
+         ++next_backfill_block;
+         send_pending_blocks(serialize_lookahead);
+      }
+      memory.release( approx_size( *block ));
+      backfill_process_queue.pop_front();
+   }
+
+   // process irreversible blocks, keeping up to serialize_lookahead blocks in the pool
+   while (!irreversible_block_state_process_queue.empty()) {
+      const auto& e = irreversible_block_state_process_queue.front();
+      if( backfilling ) {
+         held_irreversible_blocks.hold(e); // stays charged while held
+      } else {
+         export_irreversible_entry(e);
+      }
+      irreversible_block_state_process_queue.pop_front();
+   }
+   check_backfill_handoff();
+   send_pending_blocks(0);
+   memory.set_in_flight( message_arenas.bytes_in_use() );
+}
+
+void grpc_client_plugin_impl::export_irreversible_entry( const irreversible_entry& e ) {
+   if( !export_failed ) {
+      uint32_t block_num = e.block_num; // the block being read, for the error
+      try {
+         const bool exported = live_cursor.advance( e.block_num, [&]( uint32_t num ) {
+            block_num = num;
+            export_logged_block( num );
+         } );
+         block_num = e.block_num;
+         if( exported && e.block ) {
+            process_irreversible_block( e.block );
+            send_pending_blocks(serialize_lookahead);
+         } else if( exported ) {
+            // spilled, read back from the log
+            export_logged_block( e.block_num );
          }
+      } catch (fc::exception& ex) {
+         fail_export( block_num, ex.to_detail_string() );
+      } catch (std::exception& ex) {
+         fail_export( block_num, ex.what() );
+      }
+   }
+   memory.release( e.charged );
+}
+
+template<typename Entry, typename Process>
+void grpc_client_plugin_impl::run_stream( stream_stats& stats, std::deque<Entry>& backlog, Process&& process ) {
+   if( backlog.empty() )
+      return;
+   // no budget while draining for shutdown
+   const bool budgeted = stream_budget.count() > 0 && !done;
+   const auto deadline = std::chrono::steady_clock::now() + stream_budget;
+   uint64_t processed = 0;
+   while( !backlog.empty() ) {
+      if( budgeted && processed > 0 && std::chrono::steady_clock::now() >= deadline ) {
+         ++stats.deferred;
+         break;
+      }
+      process( backlog.front() );
+      backlog.pop_front();
+      ++processed;
+   }
+   stats.processed += processed;
+}
 
-         //process accepted transactions
-         while (!transaction_metadata_process_queue.empty()) {
-            const auto& t = transaction_metadata_process_queue.front();
-            process_accepted_transaction(t);
-            transaction_metadata_process_queue.pop_front();
+void grpc_client_plugin_impl::consume_blocks() {
+   try {
+      while (true) {
+         if( queues_empty() && backlogs_empty() && !done ) {
+            boost::mutex::scoped_lock lock(mtx);
+            consumer_sleeping.store(true, std::memory_order_relaxed);
+            // publish sleeping before the queues are checked again, see wake_consumer
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            // open batches, retry backoffs and calls held by an open breaker need polling
+            bool polling = batch_max_kb > 0;
+            for( const auto& p : partitions )
+               polling = polling || (!p->spool && p->stub->BlockRequestsWaiting()) || p->stub->StreamsWaiting();
+            const uint32_t poll_ms = batch_max_kb > 0 ? batch_max_ms : 10;
+            while ( queues_empty() && !done ) {
+               if( !polling ) {
+                  condition.wait(lock);
+               } else if( condition.wait_for(lock, boost::chrono::milliseconds(poll_ms)) == boost::cv_status::timeout ) {
+                  break; // send batches that reached their time limit, restart calls that are due
+               }
+            }
+            consumer_sleeping.store(false, std::memory_order_relaxed);
          }
 
-         // process blocks
-         while (!block_state_process_queue.empty()) {
-            const auto& bs = block_state_process_queue.front();
-            process_accepted_block( bs );
-            block_state_process_queue.pop_front();
+         if (done) {
+            drain_queues();
+            ilog("draining queue, size: ${q}", ("q", transaction_metadata_process_queue.size() + transaction_trace_process_queue.size() +
+                                                     block_state_process_queue.size() + irreversible_block_state_process_queue.size() +
+                                                     backfill_process_queue.size()));
          }
 
-         // process irreversible blocks
-         while (!irreversible_block_state_process_queue.empty()) {
-            const auto& bs = irreversible_block_state_process_queue.front();
-            process_irreversible_block(bs);
-            irreversible_block_state_process_queue.pop_front();
+         // irreversible blocks never wait behind the other streams, which are served in priority
+         // order within their budget with irreversible blocks checked again after each of them
+         export_irreversible();
+         run_stream( accepted_block_stats, block_state_process_queue, [this]( const accepted_block_entry& e ) {
+            process_accepted_block( e );
+            memory.release( e.charged );
+         } );
+         export_irreversible();
+         // applied transactions are sent with the block they were applied in
+         run_stream( applied_transaction_stats, transaction_trace_process_queue, [this]( const trace_entry& e ) {
+            if( e.trace )
+               process_applied_transaction( e.trace );
+            else
+               process_trace_block( e.block );
+            memory.release( e.charged );
+         } );
+         export_irreversible();
+         run_stream( accepted_transaction_stats, transaction_metadata_process_queue,
+                     [this]( const chain::transaction_metadata_ptr& t ) {
+            process_accepted_transaction( t );
+            memory.release( approx_size( *t ));
+         } );
+
+         for( auto& p : partitions ) {
+            if( p->spool )
+               p->spool->sync();
+            else
+               p->stub->PollBlockRequests();
+            p->stub->PollStreams();
          }
 
-         if( transaction_metadata_size == 0 &&
-             transaction_trace_size == 0 &&
-             block_state_size == 0 &&
-             irreversible_block_size == 0 &&
-             done ) {
+         if( done && queues_empty() && backlogs_empty() ) {
             break;
          }
       }
+      for( auto& p : partitions ) {
+         if( !p->spool )
+            p->stub->FlushBlockRequests();
+         p->stub->FlushTransferRequests();
+         p->stub->FlushTraceRequests();
+         p->stub->FlushHeadEvents();
+      }
+      if( !abi_cache_snapshot.empty() ) {
+         abi_cache_index.save( abi_cache_snapshot );
+         ilog("grpc_client saved ${n} abis to ${f}", ("n", abi_cache_index.size())("f", abi_cache_snapshot));
+      }
       ilog("grpc_client consume thread shutdown gracefully");
    } catch (fc::exception& e) {
       elog("FC Exception while consuming block ${e}", ("e", e.to_string()));
@@ -518,33 +1883,211 @@ void grpc_client_plugin_impl::consume_blocks() {
    }
 }
 
-void grpc_client_plugin_impl::purge_abi_cache() {
-   if( abi_cache_index.size() < abi_cache_size ) return;
+void grpc_client_plugin_impl::backfill() {
+   try {
+      uint32_t next = next_backfill_block;
+      ilog( "grpc_client backfilling from block ${b}", ("b", next) );
+      boost::asio::thread_pool decode_pool( std::max<uint32_t>( backfill_threads, 1 ));
+      std::vector<char> buffer;
+      std::vector<uint64_t> offsets;
+      while( !backfill_stop && !done ) {
+         const uint32_t last = backfill_reader.last_block_num();
+         // keep a couple of chunks ahead of the consume thread, the log only grows slowly at its end
+         if( next > last || backfill_queue.size() >= 2 * backfill_chunk_blocks || memory.over() ) {
+            boost::this_thread::sleep_for( boost::chrono::milliseconds( next > last ? 200 : 5 ));
+            continue;
+         }
+         const uint32_t to = std::min<uint64_t>( last, uint64_t( next ) + backfill_chunk_blocks - 1 );
+         backfill_reader.read( next, to, buffer, offsets );
+
+         // decode in parallel, then hand the blocks over in order
+         std::vector<chain::signed_block_ptr> blocks( to - next + 1 );
+         std::vector<std::future<void>> parts;
+         const size_t threads = std::max<uint32_t>( backfill_threads, 1 );
+         const size_t chunk = (blocks.size() + threads - 1) / threads;
+         for( size_t begin = 0; begin < blocks.size(); begin += chunk ) {
+            const size_t end = std::min( begin + chunk, blocks.size() );
+            auto part = std::make_shared<std::packaged_task<void()>>( [&, begin, end]() {
+               for( size_t i = begin; i < end; ++i ) {
+                  blocks[i] = block_log_reader::unpack( buffer.data() + offsets[i], offsets[i + 1] - offsets[i], next + i );
+               }
+            } );
+            parts.emplace_back( part->get_future() );
+            boost::asio::post( decode_pool, [part]() { (*part)(); } );
+         }
+         for( auto& part : parts )
+            part.wait();
+         for( auto& part : parts )
+            part.get();
+         for( auto& block : blocks ) {
+            memory.charge( approx_size( *block ));
+            queue( backfill_queue, block );
+         }
+         next = to + 1;
+      }
+      decode_pool.join();
+   } catch (fc::exception& e) {
+      elog("FC Exception while backfilling ${e}", ("e", e.to_detail_string()));
+      backfill_failed = true;
+   } catch (std::exception& e) {
+      elog("STD Exception while backfilling ${e}", ("e", e.what()));
+      backfill_failed = true;
+   } catch (...) {
+      elog("Unknown exception while backfilling");
+      backfill_failed = true;
+   }
+   wake_consumer();
+}
 
-   // remove the oldest (smallest) last accessed
-   auto& idx = abi_cache_index.get<by_last_access>();
-   auto itr = idx.begin();
-   if( itr != idx.end() ) {
-      idx.erase( itr );
+void grpc_client_plugin_impl::check_backfill_handoff() {
+   if( !backfilling )
+      return;
+   auto release = [this]( const irreversible_entry& e ) { export_irreversible_entry( e ); };
+   if( backfill_failed ) {
+      // the blocks from here on can not be read from the log, nor be skipped
+      backfilling = false;
+      backfill_stop = true;
+      fail_export( next_backfill_block, "backfill from blocks.log failed" );
+      held_irreversible_blocks.release_all( release );
+      return;
    }
+   // blocks.log gets a block before its irreversible signal, so the backfill always reaches the
+   // first held block; live blocks it exported already are skipped
+   if( !held_irreversible_blocks.try_release( next_backfill_block, live_cursor, release ))
+      return;
+   backfilling = false;
+   backfill_stop = true;
+   ilog( "grpc_client backfill done up to block ${b}, continued with the live stream", ("b", next_backfill_block - 1) );
 }
 
-optional<abi_serializer> grpc_client_plugin_impl::get_abi_serializer( account_name n ) {
-   if( n.good()) {
+void grpc_client_plugin_impl::export_logged_block( uint32_t block_num ) {
+   // the controller appends a block to the log before it signals it irreversible, so a failed
+   // read is retried for a while before the caller gives up on the block
+   const uint32_t attempts = 10;
+   chain::signed_block_ptr block;
+   for( uint32_t attempt = 1; !block; ++attempt ) {
       try {
+         block = spill_reader.read_block( block_num, std::chrono::seconds( 1 ));
+      } catch (fc::exception& ex) {
+         if( attempt >= attempts )
+            throw;
+         wlog( "grpc_client reading block ${b} from the block log failed, attempt ${a} of ${n}: ${e}",
+               ("b", block_num)("a", attempt)("n", attempts)("e", ex.to_string()) );
+         boost::this_thread::sleep_for( boost::chrono::milliseconds( 100 * attempt ));
+      }
+   }
+   process_irreversible_block( block );
+   send_pending_blocks( serialize_lookahead );
+}
 
-         auto itr = abi_cache_index.find( n );
-         if( itr != abi_cache_index.end() ) {
-            abi_cache_index.modify( itr, []( auto& entry ) {
-               entry.last_accessed = fc::time_point::now();
-            });
+void grpc_client_plugin_impl::fail_export( uint32_t block_num, const std::string& reason ) {
+   elog( "grpc_client can not export irreversible block ${b}: ${r}. Export stopped and node shutting down so no block "
+         "is skipped, restart it with --grpc-client-backfill-from=${b}", ("b", block_num)("r", reason) );
+   export_failed = true;
+   app().quit();
+}
 
-            return itr->serializer;
-         }
+abi_serializer_ref grpc_client_plugin_impl::get_abi_serializer( account_name n ) {
+   abi_serializer_ref ref;
+   if( n.good()) {
+      try {
+         if( abi_cache_index.lookup( n, ref ))
+            return ref;
 
+         // miss, the chain state answer is cached including accounts without an abi
+         if( fetch_abi( n ))
+            abi_cache_index.lookup( n, ref );
       } FC_CAPTURE_AND_LOG((n))
    }
-   return optional<abi_serializer>();
+   return ref;
+}
+
+bool grpc_client_plugin_impl::fetch_abi( account_name n ) {
+   // chainbase is only safe to read from the main thread; this reflects head state, which is
+   // what a later setabi would have put in the cache anyway
+   if( done ) // the main thread is waiting on us in plugin_shutdown
+      return false;
+   abi_fetch fetch;
+   bool posted = false;
+   {
+      std::lock_guard<std::mutex> lock( abi_fetch_mtx );
+      auto itr = abi_fetches.find( n.value );
+      if( itr == abi_fetches.end() ) {
+         auto result = std::make_shared<std::promise<void>>();
+         itr = abi_fetches.emplace( n.value, abi_fetch{ result->get_future().share(),
+                                                        std::chrono::steady_clock::now() + std::chrono::seconds( 1 ) } ).first;
+         std::weak_ptr<grpc_client_plugin_impl> weak = shared_from_this();
+         // the read is cached even when every miss gave up on it, e.g. during replay before the
+         // main thread runs its io_service
+         app().get_io_service().post( [weak, result, n]() {
+            auto self = weak.lock();
+            if( !self )
+               return;
+            try {
+               const auto& db = app().get_plugin<chain_plugin>().chain().db();
+               const auto* account = db.find<chain::account_object, chain::by_name>( n );
+               self->abi_cache_index.set( n, account ? chain::bytes( account->abi.begin(), account->abi.end() ) : chain::bytes() );
+               result->set_value();
+            } catch( ... ) {
+               result->set_exception( std::current_exception() );
+            }
+            std::lock_guard<std::mutex> lock( self->abi_fetch_mtx );
+            self->abi_fetches.erase( n.value );
+         } );
+         posted = true;
+      }
+      fetch = itr->second;
+   }
+   // after the deadline a pending read is not waited for again, the account is exported without its abi
+   if( fetch.done.wait_until( fetch.deadline ) != std::future_status::ready ) {
+      if( posted )
+         wlog( "grpc_client timed out reading abi of ${n} from chain state, it is cached once read", ("n", n) );
+      return false;
+   }
+   fetch.done.get();
+   return true;
+}
+
+void grpc_client_plugin_impl::learn_abi( const chain::action_trace& atrace ) {
+   if( atrace.receipt.receiver == chain::config::system_account_name )
+      learn_abi( atrace.act );
+   for( const auto& inline_trace : atrace.inline_traces )
+      learn_abi( inline_trace );
+}
+
+void grpc_client_plugin_impl::learn_abi( const transaction& trx ) {
+   // without traces only top level setabi actions of irreversible blocks are seen,
+   // an inline one is picked up from chain state once the cached abi is evicted
+   for( const auto& act : trx.actions )
+      learn_abi( act );
+}
+
+void grpc_client_plugin_impl::learn_abi( const packed_transaction& pt ) {
+   // account and name of an action are packed next to each other, so a transaction without
+   // eosio::setabi is skipped without unpacking it; a false match only costs the unpack
+   static const auto pattern = []() {
+      std::array<char, 16> p;
+      const uint64_t account = chain::config::system_account_name.value;
+      const uint64_t name = chain::setabi::get_name().value;
+      memcpy( p.data(), &account, sizeof( account ));
+      memcpy( p.data() + sizeof( account ), &name, sizeof( name ));
+      return p;
+   }();
+   if( pt.compression == packed_transaction::none ) {
+      if( std::search( pt.packed_trx.begin(), pt.packed_trx.end(), pattern.begin(), pattern.end() ) == pt.packed_trx.end() )
+         return;
+      learn_abi( fc::raw::unpack<transaction>( pt.packed_trx ));
+      return;
+   }
+   learn_abi( fc::raw::unpack<transaction>( pt.get_raw_transaction() ));
+}
+
+void grpc_client_plugin_impl::learn_abi( const chain::action& act ) {
+   if( act.account == chain::config::system_account_name && act.name == chain::setabi::get_name() ) {
+      auto setabi = act.data_as<chain::setabi>();
+      ilog( "grpc_client learned abi of ${a} from setabi", ("a", setabi.account) );
+      abi_cache_index.set( setabi.account, std::move( setabi.abi ));
+   }
 }
 
 template<typename T>
@@ -558,58 +2101,214 @@ fc::variant grpc_client_plugin_impl::to_variant_with_abi( const T& obj ) {
 
 void grpc_client_plugin_impl::insert_default_abi()
 {
-   //eosio.token
-   {
-      auto abiPath = app().config_dir() / "eosio.token" += ".abi";
-      FC_ASSERT( fc::exists( abiPath ), "no abi file found ");
-      auto abijson = fc::json::from_file(abiPath).as<abi_def>();
-      auto abi = fc::raw::pack(abijson);
-      abi_def abi_def = fc::raw::unpack<chain::abi_def>( abi );
-     // const string json_str = fc::json::to_string( abi_def );
-     purge_abi_cache(); // make room if necessary
-     abi_cache entry;
-     entry.account = N(eosio.token);
-     entry.last_accessed = fc::time_point::now();
-     abi_serializer abis;
-     abis.set_abi( abi_def, abi_serializer_max_time );
-     entry.serializer.emplace( std::move( abis ) );
-     abi_cache_index.insert( entry );
-   }
-
-   //eosio
-   {
-      auto abiPath = app().config_dir() / "System01" += ".abi";
-      FC_ASSERT( fc::exists( abiPath ), "no abi file found ");
+   // abis shipped in the config dir seed the cache until a setabi replaces them
+   const std::vector<std::pair<account_name, std::string>> defaults = {
+      { N(eosio.token), "eosio.token" },
+      { N(eosio),       "System01" }
+   };
+   for( const auto& def : defaults ) {
+      auto abiPath = app().config_dir() / def.second += ".abi";
+      if( !fc::exists( abiPath ))
+         continue;
       auto abijson = fc::json::from_file(abiPath).as<abi_def>();
-      auto abi = fc::raw::pack(abijson);
-      abi_def abi_def = fc::raw::unpack<chain::abi_def>( abi );
-     // const string json_str = fc::json::to_string( abi_def );
-     purge_abi_cache(); // make room if necessary
-     abi_cache entry;
-     entry.account = N(eosio);
-     entry.last_accessed = fc::time_point::now();
-     abi_serializer abis;
-     abis.set_abi( abi_def, abi_serializer_max_time );
-     entry.serializer.emplace( std::move( abis ) );
-     abi_cache_index.insert( entry );
+      abi_cache_index.set( def.first, fc::raw::pack(abijson) );
    }
-
-
 }
 
 void grpc_client_plugin_impl::init()
 {
    try {
-      _grpc_stub.reset(new grpc_stub(grpc::CreateChannel(
-            client_address, grpc::InsecureChannelCredentials())));
-      _grpc_stub->PutRequest(std::string("init"),std::string("init--json"));
+      for( const auto& address : client_addresses ) {
+         std::unique_ptr<export_partition> p(new export_partition);
+         p->index = partitions.size();
+         p->address = address;
+         std::vector<std::shared_ptr<Channel>> channels;
+         for( uint32_t i = 0; i < subchannels; ++i )
+            channels.emplace_back( grpc::CreateCustomChannel( address, grpc::InsecureChannelCredentials(), channel_arguments( i )));
+         p->stub.reset(new grpc_stub(channels));
+         p->stub->SetLatencyHistogram(&p->metrics.rpc_latency);
+         p->stub->SetBlockWindow(block_window);
+         if( block_compression )
+            p->stub->SetBlockCompression(*block_compression);
+         p->stub->SetRetryPolicy(retry_policy);
+         if( batch_max_kb > 0 )
+            p->stub->SetBatching(uint64_t( batch_max_kb ) * 1024, std::chrono::milliseconds( batch_max_ms ), std::chrono::milliseconds( batch_latency_ms ));
+         auto& part = *p;
+         const bool compressed = block_compression ? *block_compression != GRPC_COMPRESS_NONE : channel_compression != GRPC_COMPRESS_NONE;
+         p->stub->SetBlockCallback( [&part, compressed]( const BlockRequest& request, const Status& status ) {
+            if( status.ok() ) {
+               const auto size = request.ByteSizeLong();
+               if( compressed && part.metrics.blocks_sent % compression_sample_rate == 0 ) {
+                  part.metrics.sampled_bytes += size;
+                  part.metrics.sampled_compressed_bytes += fc::zlib_compress( request.SerializeAsString() ).size();
+               }
+               ++part.metrics.blocks_sent;
+               part.metrics.transactions_sent += request.trans_size();
+               part.metrics.bytes_sent += size;
+               part.metrics.block_bytes.record( size );
+               part.metrics.last_acked_block = request.blocknum();
+               part.metrics.last_ack_time = fc::time_point::now().sec_since_epoch();
+            } else {
+               ++part.metrics.blocks_failed;
+            }
+            if( part.spool && !part.send_failed ) {
+               if( status.ok() )
+                  part.spool->ack( request.blocknum() );
+               else
+                  part.send_failed = true;
+            }
+         } );
+         partitions.emplace_back( std::move( p ));
+      }
+      if( serialize_threads > 0 )
+         serialize_pool.reset( new boost::asio::thread_pool( serialize_threads ));
+      insert_default_abi();
+      if( !abi_cache_snapshot.empty() ) {
+         try {
+            fc::create_directories( abi_cache_snapshot.parent_path() );
+            ilog( "grpc_client loaded ${n} abis from ${f}", ("n", abi_cache_index.load( abi_cache_snapshot ))("f", abi_cache_snapshot) );
+         } FC_LOG_AND_DROP()
+      }
+      for( auto& p : partitions ) {
+         auto& part = *p;
+         // never block node startup on the downstream, connect and warm up in the background
+         part.connect_thread = boost::thread([this, &part] { connect( part ); });
+         if( !spool_dir.empty() ) {
+            part.spool.reset( new block_spool );
+            part.spool->open( partitions.size() == 1 ? spool_dir : spool_dir / ("partition-" + std::to_string( part.index )), spool_segment_size );
+            part.sender_thread = boost::thread([this, &part] { send_spooled_blocks( part ); });
+         }
+      }
+      if( !spool_dir.empty() && !backfilling ) {
+         // blocks that were queued but not spooled when the node stopped are not signaled again,
+         // the live stream continues after the partition that spooled the least
+         uint32_t resume = 0;
+         for( const auto& p : partitions ) {
+            const auto last = p->spool->last_spooled_block();
+            if( last > 0 && (resume == 0 || last + 1 < resume) )
+               resume = last + 1;
+         }
+         if( resume > 0 ) {
+            ilog( "grpc_client export resumes at block ${b}, blocks before the first live one are read from the block log", ("b", resume) );
+            live_cursor.start( resume );
+         }
+      }
       client_thread = boost::thread([this] { consume_blocks(); });
+      if( backfilling )
+         backfill_thread = boost::thread([this] { backfill(); });
    } catch(...) {
          elog( "grpc_client unknown exception, init failed, line ${line_nun}", ( "line_num", __LINE__ ));
       }
    startup = false;
 }
 
+metrics_report grpc_client_plugin_impl::report_metrics() const
+{
+   metrics_report r;
+   const double ns = 1e-9;
+   auto queue_metrics = [&r, ns]( const char* name, const auto& queue, const latency_histogram& wait ) {
+      const std::string labels = std::string( "queue=\"" ) + name + "\"";
+      r.gauge( "grpc_client_queue_depth", "Entries waiting in a queue for the consume thread", queue.size(), labels );
+      r.counter( "grpc_client_queue_enqueued_total", "Entries pushed to a queue", queue.enqueued_count(), labels );
+      r.counter( "grpc_client_queue_dropped_total", "Entries dropped because a queue was full", queue.dropped_count(), labels );
+      r.counter( "grpc_client_queue_spilled_total", "Entries moved to the overflow list of a full queue", queue.spilled_count(), labels );
+      r.histogram( "grpc_client_queue_wait_seconds", "Time from controller signal to the consume thread", wait.read(), ns, labels );
+   };
+   queue_metrics( "accepted_transaction", transaction_metadata_queue, transaction_metadata_wait );
+   queue_metrics( "applied_transaction", transaction_trace_queue, transaction_trace_wait );
+   queue_metrics( "accepted_block", block_state_queue, block_state_wait );
+   queue_metrics( "irreversible_block", irreversible_block_state_queue, irreversible_block_wait );
+
+   for( const auto* st : { &accepted_block_stats, &applied_transaction_stats, &accepted_transaction_stats } ) {
+      const std::string labels = std::string( "stream=\"" ) + st->name + "\"";
+      r.counter( "grpc_client_stream_processed_total", "Entries the consume thread processed for a stream", st->processed.load(), labels );
+      r.counter( "grpc_client_stream_deferred_total", "Rounds a stream used up its budget and kept a backlog", st->deferred.load(), labels );
+   }
+
+   r.gauge( "grpc_client_memory_budget_bytes", "Memory budget of queued chain objects and messages in flight, 0 for none", memory.limit() );
+   r.gauge( "grpc_client_memory_queued_bytes", "Estimated memory kept alive by queued chain objects", memory.queued() );
+   r.gauge( "grpc_client_memory_in_flight_bytes", "Memory of export messages being built or sent", memory.in_flight() );
+   r.counter( "grpc_client_memory_overflow_total", "Entries over the memory budget", memory_shed.load(), "action=\"shed\"" );
+   r.counter( "grpc_client_memory_overflow_total", "Entries over the memory budget", memory_downgraded.load(), "action=\"downgraded\"" );
+   r.counter( "grpc_client_memory_overflow_total", "Entries over the memory budget", memory_spilled.load(), "action=\"spilled\"" );
+
+   r.histogram( "grpc_client_unpack_seconds", "Time to unpack a transaction", unpack_time.read(), ns );
+   r.histogram( "grpc_client_abi_serialize_seconds", "Time to convert a transaction to a variant with its contract abis", abi_serialize_time.read(), ns );
+   r.histogram( "grpc_client_json_encode_seconds", "Time to encode a transaction as json, the whole transaction with grpc-client-json-writer=stream", json_encode_time.read(), ns );
+   r.gauge( "grpc_client_pending_blocks", "Irreversible blocks being serialized or waiting to be sent", pending_block_count.load() );
+   r.gauge( "grpc_client_last_irreversible_block", "Last irreversible block signalled by the controller", last_irreversible_block.load() );
+
+   for( const auto& p : partitions ) {
+      const std::string labels = "server=\"" + p->address + "\"";
+      const auto& m = p->metrics;
+      r.counter( "grpc_client_blocks_sent_total", "Blocks acknowledged by the server", m.blocks_sent.load(), labels );
+      r.counter( "grpc_client_blocks_failed_total", "Blocks whose export failed", m.blocks_failed.load(), labels );
+      r.counter( "grpc_client_transactions_sent_total", "Transactions acknowledged by the server", m.transactions_sent.load(), labels );
+      r.counter( "grpc_client_bytes_sent_total", "Uncompressed block message bytes acknowledged by the server", m.bytes_sent.load(), labels );
+      r.gauge( "grpc_client_last_acked_block", "Last block acknowledged by the server", m.last_acked_block.load(), labels );
+      r.gauge( "grpc_client_last_ack_timestamp_seconds", "Unix time of the last acknowledgement", m.last_ack_time.load(), labels );
+      if( p->spool )
+         r.gauge( "grpc_client_spool_backlog_blocks", "Spooled blocks not yet acknowledged",
+                  p->spool->last_spooled_block() - p->spool->last_acked_block(), labels );
+      r.histogram( "grpc_client_rpc_latency_seconds", "Latency of block export calls", m.rpc_latency.read(), ns, labels );
+      r.histogram( "grpc_client_block_bytes", "Uncompressed size of exported block messages", m.block_bytes.read(), 1, labels );
+   }
+
+   r.gauge( "grpc_client_export_failed", "1 once an irreversible block could not be exported and the export stopped", export_failed ? 1 : 0 );
+   if( backfill_from > 0 )
+      r.gauge( "grpc_client_backfill_next_block", "Next block the backfill exports from the block log, 0 once done",
+               backfill_stop ? 0 : next_backfill_block.load() );
+   if( head_stream ) {
+      r.gauge( "grpc_client_last_head_block", "Last accepted block sent on the head stream", last_head_block.load() );
+      r.counter( "grpc_client_head_blocks_undone_total", "Head stream blocks undone by fork switches", head_blocks_undone.load() );
+   }
+   if( trace_stream ) {
+      r.counter( "grpc_client_traces_sent_total", "Transaction traces sent with their accepted block", traces_sent.load() );
+      r.counter( "grpc_client_traces_dropped_total", "Speculative transaction traces not in the block they were applied to", traces_dropped.load() );
+   }
+   if( !transaction_filter.empty() ) {
+      r.counter( "grpc_client_filter_checked_total", "Transactions checked by the filters", transaction_filter.checked_count() );
+      r.counter( "grpc_client_filter_dropped_total", "Transactions dropped by the filters", transaction_filter.filtered_count() );
+   }
+   return r;
+}
+
+grpc::ChannelArguments grpc_client_plugin_impl::channel_arguments( uint32_t subchannel ) const
+{
+   grpc::ChannelArguments args;
+   args.SetCompressionAlgorithm( channel_compression );
+   args.SetMaxSendMessageSize( max_message_mb * 1024 * 1024 );
+   args.SetMaxReceiveMessageSize( max_message_mb * 1024 * 1024 );
+   if( stream_window_kb > 0 )
+      args.SetInt( GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES, stream_window_kb * 1024 );
+   if( keepalive_ms > 0 ) {
+      args.SetInt( GRPC_ARG_KEEPALIVE_TIME_MS, keepalive_ms );
+      args.SetInt( GRPC_ARG_KEEPALIVE_TIMEOUT_MS, keepalive_timeout_ms );
+      args.SetInt( GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1 );
+      args.SetInt( GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, 0 );
+   }
+   // a distinct argument keeps gRPC from sharing one connection between our channels
+   args.SetInt( "grpc_client_plugin.subchannel", subchannel );
+   return args;
+}
+
+void grpc_client_plugin_impl::connect(export_partition& p)
+{
+   try {
+      for( uint32_t attempt = 0; !done; ++attempt ) {
+         if( p.stub->WarmUp() ) {
+            ilog( "grpc_client connected to ${a}", ("a", p.address) );
+            return;
+         }
+         const auto delay = retry_policy.backoff( attempt );
+         wlog( "grpc_client unable to reach ${a}, retrying in ${d} ms", ("a", p.address)("d", delay.count()) );
+         boost::this_thread::sleep_for( boost::chrono::milliseconds( delay.count() ));
+      }
+   } catch( boost::thread_interrupted& ) {
+   } catch( std::exception& e ) {
+      elog( "Exception while connecting grpc_client: ${e}", ("e", e.what()));
+   }
+}
 
 
 grpc_client_plugin_impl::~grpc_client_plugin_impl()
@@ -618,8 +2317,44 @@ grpc_client_plugin_impl::~grpc_client_plugin_impl()
       try {
          ilog( "grpc shutdown in process please be patient this can take a few minutes" );
          done = true;
-         condition.notify_one();
+         for( auto& p : partitions ) {
+            p->stub->Stop();
+            p->connect_thread.interrupt();
+            p->connect_thread.join();
+         }
+         {
+            boost::mutex::scoped_lock lock( mtx );
+            condition.notify_one();
+         }
+         backfill_stop = true;
+         if( backfill_thread.joinable() )
+            backfill_thread.join();
          client_thread.join();
+         sender_done = true;
+         for( auto& p : partitions ) {
+            if( p->spool ) {
+               p->spool->notify();
+               p->sender_thread.join();
+               p->spool->close();
+            }
+            ilog( "grpc_client ${a}: ${b} blocks, ${t} transactions, ${n} bytes sent, ${f} blocks failed, ${r} compression ratio",
+                  ("a", p->address)("b", p->metrics.blocks_sent.load())("t", p->metrics.transactions_sent.load())
+                  ("n", p->metrics.bytes_sent.load())("f", p->metrics.blocks_failed.load())("r", p->metrics.compression_ratio()) );
+         }
+         if( !transaction_filter.empty() ) {
+            ilog( "grpc_client filter checked ${c} transactions, dropped ${f}, ${n} matching no include rule",
+                  ("c", transaction_filter.checked_count())("f", transaction_filter.filtered_count())("n", transaction_filter.not_included_count()) );
+            for( const auto& r : transaction_filter.stats() )
+               ilog( "grpc_client filter ${t} ${r}: ${m} actions matched, ${d} transactions dropped",
+                     ("t", r.include ? "on" : "out")("r", r.rule)("m", r.matched)("d", r.dropped) );
+         }
+         ilog( "grpc_client enqueued ${n} entries, ${d} dropped, ${s} spilled, ${ns} ns average enqueue",
+               ("n", irreversible_block_state_queue.enqueued_count())
+               ("d", irreversible_block_state_queue.dropped_count())
+               ("s", irreversible_block_state_queue.spilled_count())
+               ("ns", irreversible_block_state_queue.enqueue_time_ns() / std::max<uint64_t>( irreversible_block_state_queue.enqueued_count(), 1 )));
+         if( serialize_pool )
+            serialize_pool->join();
       } catch( std::exception& e ) {
          elog( "Exception on mongo_db_plugin shutdown of consume thread: ${e}", ("e", e.what()));
       }
@@ -641,10 +2376,108 @@ grpc_client_plugin::~grpc_client_plugin()
 void grpc_client_plugin::set_program_options(options_description& cli, options_description& cfg)
 {
    cfg.add_options()
-         ("grpc-client-address", bpo::value<std::string>(),
-         "grpc-client-address string.grcp server bind ip and port. Example:127.0.0.1:21005")
+         ("grpc-client-address", bpo::value<std::vector<std::string>>()->composing(),
+         "grpc-client-address string.grcp server bind ip and port. Example:127.0.0.1:21005. "
+         "May be specified multiple times to partition the export over several servers.")
+         ("grpc-client-partition", bpo::value<std::string>()->default_value("block"),
+          "How irreversible block exports are spread over several grpc-client-address servers: 'block' round-robin by block number, "
+          "'receiver' by the contract of each transaction's first action, 'actor' by its first authorizer.")
          ("grpc-abi-cache-size", bpo::value<uint32_t>()->default_value(2048),
           "The maximum size of the abi cache for serializing data.")
+         ("grpc-abi-cache-shards", bpo::value<uint32_t>()->default_value(8),
+          "The number of independently locked shards of the abi cache.")
+         ("grpc-abi-cache-snapshot", bpo::value<std::string>()->default_value("grpc_client/abi_cache.bin"),
+          "File the abi cache is saved to on shutdown and loaded from on startup, relative to the data dir. Empty to disable.")
+         ("grpc-client-block-window", bpo::value<uint32_t>()->default_value(16),
+          "The maximum number of irreversible block export calls kept in flight.")
+         ("grpc-client-queue-size", bpo::value<uint32_t>()->default_value(1024),
+          "The capacity of each queue between the controller signals and the consume thread.")
+         ("grpc-client-queue-overflow", bpo::value<std::string>()->default_value("spill"),
+          "What to do when a queue is full: 'drop' discards the entry, 'spill' keeps it in an unbounded overflow list, "
+          "'block' waits up to grpc-client-queue-block-ms for room and then drops it. The irreversible block queue always spills.")
+         ("grpc-client-memory-budget-mb", bpo::value<uint32_t>()->default_value(0),
+          "Memory budget in MiB of chain objects queued for export and export messages in flight, 0 for no budget. "
+          "Irreversible blocks are admitted over budget unless grpc-client-memory-policy=spill.")
+         ("grpc-client-memory-policy", bpo::value<std::string>()->default_value("shed"),
+          "What to do with entries over grpc-client-memory-budget-mb: shed drops accepted transactions, traces and "
+          "accepted blocks; downgrade also keeps accepted blocks as header only head events; spill also keeps irreversible "
+          "blocks as their number and reads them back from blocks.log.")
+         ("grpc-client-queue-block-ms", bpo::value<uint32_t>()->default_value(100),
+          "The maximum time a controller signal waits for queue room with grpc-client-queue-overflow=block.")
+         ("grpc-client-spool-dir", bpo::value<std::string>()->default_value(""),
+          "Directory of a durable spool for irreversible block exports, relative to the data dir. When set, blocks are "
+          "appended to it and sent from there, and export resumes after the last block the server acknowledged. Empty to disable.")
+         ("grpc-client-spool-segment-mb", bpo::value<uint32_t>()->default_value(64),
+          "Size in MiB at which a new spool segment file is started.")
+         ("grpc-client-channel-compression", bpo::value<std::string>()->default_value("none"),
+          "Default compression of every call on the export channels: none, deflate or gzip.")
+         ("grpc-client-block-compression", bpo::value<std::string>()->default_value("channel"),
+          "Compression of block export calls: channel to use grpc-client-channel-compression, none, deflate or gzip.")
+         ("grpc-client-max-message-mb", bpo::value<uint32_t>()->default_value(64),
+          "Maximum size in MiB of a message sent to or received from the export server.")
+         ("grpc-client-stream-window-kb", bpo::value<uint32_t>()->default_value(0),
+          "Initial HTTP/2 stream flow-control window in KiB, 0 for the gRPC default.")
+         ("grpc-client-keepalive-ms", bpo::value<uint32_t>()->default_value(0),
+          "Interval of HTTP/2 keepalive pings on idle export connections, 0 to disable.")
+         ("grpc-client-keepalive-timeout-ms", bpo::value<uint32_t>()->default_value(20000),
+          "Time to wait for a keepalive ping ack before the connection is considered dead.")
+         ("grpc-client-subchannels", bpo::value<uint32_t>()->default_value(1),
+          "Number of separate connections per export server, block calls are spread over them round-robin.")
+         ("grpc-client-deadline-ms", bpo::value<uint32_t>()->default_value(5000),
+          "Deadline of every rpc to the grpc-client-address server.")
+         ("grpc-client-retry-max", bpo::value<uint32_t>()->default_value(5),
+          "Number of times a failed block export is retried before it is given up (or left in the spool).")
+         ("grpc-client-backoff-min-ms", bpo::value<uint32_t>()->default_value(100),
+          "Initial retry backoff, doubled on every attempt with random jitter.")
+         ("grpc-client-backoff-max-ms", bpo::value<uint32_t>()->default_value(10000),
+          "Upper bound of the retry backoff.")
+         ("grpc-client-breaker-failures", bpo::value<uint32_t>()->default_value(5),
+          "Consecutive rpc failures after which sending stops for grpc-client-breaker-cooldown-ms.")
+         ("grpc-client-breaker-cooldown-ms", bpo::value<uint32_t>()->default_value(10000),
+          "How long the circuit breaker stays open before probing the server again.")
+         ("grpc-client-export-mode", bpo::value<std::string>()->default_value("json"),
+          "How irreversible block transactions are exported: 'json' renders them with their contract abi, "
+          "'binary' sends the raw packed_transaction, id, signatures and receipt status without abi serialization.")
+         ("grpc-client-json-writer", bpo::value<std::string>()->default_value("variant"),
+          "How json exports are rendered: 'variant' builds an fc::variant with abi_serializer and prints it, "
+          "'stream' writes the json straight from the packed action data. Both produce the same text.")
+         ("grpc-client-serialize-threads", bpo::value<uint32_t>()->default_value(2),
+          "Number of threads serializing irreversible block transactions, 0 to serialize on the consume thread.")
+         ("grpc-client-stream-budget-us", bpo::value<uint32_t>()->default_value(2000),
+          "Time in microseconds the consume thread spends on the accepted block, applied transaction and accepted "
+          "transaction streams each before it exports irreversible blocks again, 0 for no limit.")
+         ("grpc-client-serialize-lookahead", bpo::value<uint32_t>()->default_value(8),
+          "The maximum number of irreversible blocks being serialized ahead of the block being sent.")
+         ("grpc-client-batch-max-kb", bpo::value<uint32_t>()->default_value(0),
+          "Upper bound in KiB of a batch of consecutive blocks sent in one rpc_sendblocks call, 0 sends every block "
+          "with its own rpc_sendaction call and skips empty blocks.")
+         ("grpc-client-batch-max-ms", bpo::value<uint32_t>()->default_value(50),
+          "The maximum time a batch is kept open waiting for more blocks.")
+         ("grpc-client-batch-latency-ms", bpo::value<uint32_t>()->default_value(200),
+          "Target latency of a batch call, the batch size shrinks above it and grows well below it.")
+         ("grpc-client-filter-on", bpo::value<std::vector<std::string>>()->composing(),
+          "Export only transactions with an action matching contract:action:actor. Contract, action and actor may be blank "
+          "or * to include all, i.e. eosio.token:transfer: or ::alice. May be specified multiple times.")
+         ("grpc-client-filter-out", bpo::value<std::vector<std::string>>()->composing(),
+          "Do not export transactions whose actions all match contract:action:actor (or miss every grpc-client-filter-on). "
+          "May be specified multiple times.")
+         ("grpc-client-transfer-stream", bpo::bool_switch()->default_value(false),
+          "Send every executed transfer action of irreversible blocks to the transfer service. Contracts with a generated "
+          "decoder (see codegen/abi_codegen.py) skip the abi_serializer, others fall back to their abi.")
+         ("grpc-client-backfill-from", bpo::value<uint32_t>()->default_value(0),
+          "Export irreversible blocks from the node's blocks.log starting at this block before the live stream, 0 to disable. "
+          "The live stream takes over right after the last backfilled block.")
+         ("grpc-client-backfill-threads", bpo::value<uint32_t>()->default_value(4),
+          "Number of threads decoding blocks read from blocks.log.")
+         ("grpc-client-backfill-chunk-blocks", bpo::value<uint32_t>()->default_value(1024),
+          "Number of blocks read from blocks.log in one sequential read.")
+         ("grpc-client-head-stream", bpo::bool_switch()->default_value(false),
+          "Send every accepted block to the block service as soon as it is applied, in binary export form, with undo "
+          "events for the blocks a fork switch removes from the chain.")
+         ("grpc-client-trace-stream", bpo::bool_switch()->default_value(false),
+          "Send the traces of the transactions of every accepted block to the trace service: action traces with inline "
+          "actions, console output and elapsed times in the binary schema of trace.proto. When disabled the applied "
+          "transaction signal is not connected and abis are learned from setabi actions in irreversible blocks.")
          ;
 }
 
@@ -652,14 +2485,221 @@ void grpc_client_plugin::plugin_initialize(const variables_map& options)
 {
    try {
          if( options.count( "grpc-client-address" )) {
-            my->client_address = options.at( "grpc-client-address" ).as<std::string>();
+            my->client_addresses = options.at( "grpc-client-address" ).as<std::vector<std::string>>();
             //b_need_start = true;
 
          if( options.count( "grpc-abi-cache-size" )) {
             my->abi_cache_size = options.at( "grpc-abi-cache-size" ).as<uint32_t>();
             EOS_ASSERT( my->abi_cache_size > 0, chain::plugin_config_exception, "mongodb-abi-cache-size > 0 required" );
          }
+         if( options.count( "grpc-client-block-window" )) {
+            my->block_window = options.at( "grpc-client-block-window" ).as<uint32_t>();
+            EOS_ASSERT( my->block_window > 0, chain::plugin_config_exception, "grpc-client-block-window > 0 required" );
+         }
+         if( options.count( "grpc-client-queue-size" )) {
+            my->max_queue_size = options.at( "grpc-client-queue-size" ).as<uint32_t>();
+            EOS_ASSERT( my->max_queue_size > 0, chain::plugin_config_exception, "grpc-client-queue-size > 0 required" );
+         }
+         if( options.count( "grpc-client-queue-overflow" )) {
+            const auto& overflow = options.at( "grpc-client-queue-overflow" ).as<std::string>();
+            if( overflow == "drop" ) {
+               my->queue_overflow = queue_overflow_policy::drop;
+            } else if( overflow == "spill" ) {
+               my->queue_overflow = queue_overflow_policy::spill;
+            } else if( overflow == "block" ) {
+               my->queue_overflow = queue_overflow_policy::block;
+            } else {
+               EOS_ASSERT( false, chain::plugin_config_exception, "Invalid grpc-client-queue-overflow: ${o}", ("o", overflow));
+            }
+         }
+         if( options.count( "grpc-client-memory-budget-mb" )) {
+            my->memory.set_limit( uint64_t( options.at( "grpc-client-memory-budget-mb" ).as<uint32_t>() ) * 1024 * 1024 );
+         }
+         if( options.count( "grpc-client-memory-policy" )) {
+            const auto& policy = options.at( "grpc-client-memory-policy" ).as<std::string>();
+            if( policy == "shed" ) {
+               my->memory_policy = memory_overflow_policy::shed;
+            } else if( policy == "downgrade" ) {
+               my->memory_policy = memory_overflow_policy::downgrade;
+            } else if( policy == "spill" ) {
+               my->memory_policy = memory_overflow_policy::spill;
+            } else {
+               EOS_ASSERT( false, chain::plugin_config_exception, "Invalid grpc-client-memory-policy: ${p}", ("p", policy));
+            }
+         }
+         if( options.count( "grpc-client-queue-block-ms" )) {
+            my->queue_block_ms = options.at( "grpc-client-queue-block-ms" ).as<uint32_t>();
+         }
+         {
+            const std::chrono::microseconds block_time( my->queue_block_ms * 1000 );
+            auto impl = my.get();
+            auto wake = [impl]() { impl->wake_consumer(); };
+            my->transaction_metadata_queue.configure( my->max_queue_size, my->queue_overflow, block_time, wake );
+            my->transaction_trace_queue.configure( my->max_queue_size, my->queue_overflow, block_time, wake );
+            my->block_state_queue.configure( my->max_queue_size, my->queue_overflow, block_time, wake );
+            // the export needs every irreversible block, so its queue spills whatever the policy of the others
+            my->irreversible_block_state_queue.configure( my->max_queue_size, queue_overflow_policy::spill, block_time, wake );
+            my->transaction_metadata_queue.set_wait_histogram( &my->transaction_metadata_wait );
+            my->transaction_trace_queue.set_wait_histogram( &my->transaction_trace_wait );
+            my->block_state_queue.set_wait_histogram( &my->block_state_wait );
+            my->irreversible_block_state_queue.set_wait_histogram( &my->irreversible_block_wait );
+            // the backfill thread waits for room itself, so spilling never grows this queue much
+            my->backfill_queue.configure( my->max_queue_size, queue_overflow_policy::spill, block_time, wake );
+         }
+         if( options.count( "grpc-client-partition" )) {
+            const auto& partition = options.at( "grpc-client-partition" ).as<std::string>();
+            if( partition == "block" ) {
+               my->partition_by = grpc_client_plugin_impl::partition_mode::block;
+            } else if( partition == "receiver" ) {
+               my->partition_by = grpc_client_plugin_impl::partition_mode::receiver;
+            } else if( partition == "actor" ) {
+               my->partition_by = grpc_client_plugin_impl::partition_mode::actor;
+            } else {
+               EOS_ASSERT( false, chain::plugin_config_exception, "Invalid grpc-client-partition: ${p}", ("p", partition));
+            }
+         }
+         if( options.count( "grpc-client-spool-dir" )) {
+            const auto& dir = options.at( "grpc-client-spool-dir" ).as<std::string>();
+            if( !dir.empty() ) {
+               my->spool_dir = dir;
+               if( my->spool_dir.is_relative() )
+                  my->spool_dir = app().data_dir() / my->spool_dir;
+            }
+         }
+         if( options.count( "grpc-client-spool-segment-mb" )) {
+            my->spool_segment_size = uint64_t( options.at( "grpc-client-spool-segment-mb" ).as<uint32_t>() ) * 1024 * 1024;
+         }
+         auto to_compression = []( const std::string& name ) {
+            if( name == "none" ) return GRPC_COMPRESS_NONE;
+            if( name == "deflate" ) return GRPC_COMPRESS_DEFLATE;
+            if( name == "gzip" ) return GRPC_COMPRESS_GZIP;
+            EOS_THROW( chain::plugin_config_exception, "Invalid compression algorithm: ${n}", ("n", name));
+         };
+         if( options.count( "grpc-client-channel-compression" )) {
+            my->channel_compression = to_compression( options.at( "grpc-client-channel-compression" ).as<std::string>() );
+         }
+         if( options.count( "grpc-client-block-compression" )) {
+            const auto& compression = options.at( "grpc-client-block-compression" ).as<std::string>();
+            if( compression != "channel" ) {
+               my->block_compression = to_compression( compression );
+            }
+         }
+         if( options.count( "grpc-client-max-message-mb" )) {
+            my->max_message_mb = options.at( "grpc-client-max-message-mb" ).as<uint32_t>();
+            EOS_ASSERT( my->max_message_mb > 0 && my->max_message_mb < 2048, chain::plugin_config_exception,
+                        "grpc-client-max-message-mb must be between 1 and 2047" );
+         }
+         if( options.count( "grpc-client-stream-window-kb" )) {
+            my->stream_window_kb = options.at( "grpc-client-stream-window-kb" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-client-keepalive-ms" )) {
+            my->keepalive_ms = options.at( "grpc-client-keepalive-ms" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-client-keepalive-timeout-ms" )) {
+            my->keepalive_timeout_ms = options.at( "grpc-client-keepalive-timeout-ms" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-client-subchannels" )) {
+            my->subchannels = options.at( "grpc-client-subchannels" ).as<uint32_t>();
+            EOS_ASSERT( my->subchannels > 0, chain::plugin_config_exception, "grpc-client-subchannels > 0 required" );
+         }
+         if( options.count( "grpc-client-deadline-ms" )) {
+            my->retry_policy.deadline = std::chrono::milliseconds( options.at( "grpc-client-deadline-ms" ).as<uint32_t>() );
+            EOS_ASSERT( my->retry_policy.deadline.count() > 0, chain::plugin_config_exception, "grpc-client-deadline-ms > 0 required" );
+         }
+         if( options.count( "grpc-client-retry-max" )) {
+            my->retry_policy.max_retries = options.at( "grpc-client-retry-max" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-client-backoff-min-ms" )) {
+            my->retry_policy.backoff_min = std::chrono::milliseconds( std::max<uint32_t>( options.at( "grpc-client-backoff-min-ms" ).as<uint32_t>(), 1 ));
+         }
+         if( options.count( "grpc-client-backoff-max-ms" )) {
+            my->retry_policy.backoff_max = std::chrono::milliseconds( options.at( "grpc-client-backoff-max-ms" ).as<uint32_t>() );
+            EOS_ASSERT( my->retry_policy.backoff_max >= my->retry_policy.backoff_min, chain::plugin_config_exception,
+                        "grpc-client-backoff-max-ms >= grpc-client-backoff-min-ms required" );
+         }
+         if( options.count( "grpc-client-breaker-failures" )) {
+            my->retry_policy.breaker_failures = options.at( "grpc-client-breaker-failures" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-client-breaker-cooldown-ms" )) {
+            my->retry_policy.breaker_cooldown = std::chrono::milliseconds( options.at( "grpc-client-breaker-cooldown-ms" ).as<uint32_t>() );
+         }
+         if( options.count( "grpc-client-export-mode" )) {
+            const auto& mode = options.at( "grpc-client-export-mode" ).as<std::string>();
+            if( mode == "json" ) {
+               my->block_export_mode = grpc_client_plugin_impl::export_mode::json;
+            } else if( mode == "binary" ) {
+               my->block_export_mode = grpc_client_plugin_impl::export_mode::binary;
+            } else {
+               EOS_ASSERT( false, chain::plugin_config_exception, "Invalid grpc-client-export-mode: ${m}", ("m", mode));
+            }
+         }
+         if( options.count( "grpc-client-json-writer" )) {
+            const auto& writer = options.at( "grpc-client-json-writer" ).as<std::string>();
+            EOS_ASSERT( writer == "stream" || writer == "variant", chain::plugin_config_exception,
+                        "Invalid grpc-client-json-writer: ${w}", ("w", writer));
+            my->json_stream_writer = writer == "stream";
+         }
+         if( options.count( "grpc-client-serialize-threads" )) {
+            my->serialize_threads = options.at( "grpc-client-serialize-threads" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-client-stream-budget-us" )) {
+            my->stream_budget = std::chrono::microseconds( options.at( "grpc-client-stream-budget-us" ).as<uint32_t>() );
+         }
+         if( options.count( "grpc-client-serialize-lookahead" )) {
+            my->serialize_lookahead = options.at( "grpc-client-serialize-lookahead" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-client-batch-max-kb" )) {
+            my->batch_max_kb = options.at( "grpc-client-batch-max-kb" ).as<uint32_t>();
+            EOS_ASSERT( my->batch_max_kb < my->max_message_mb * 1024, chain::plugin_config_exception,
+                        "grpc-client-batch-max-kb must be below grpc-client-max-message-mb" );
+         }
+         if( options.count( "grpc-client-batch-max-ms" )) {
+            my->batch_max_ms = options.at( "grpc-client-batch-max-ms" ).as<uint32_t>();
+            EOS_ASSERT( my->batch_max_ms > 0, chain::plugin_config_exception, "grpc-client-batch-max-ms > 0 required" );
+         }
+         if( options.count( "grpc-client-batch-latency-ms" )) {
+            my->batch_latency_ms = options.at( "grpc-client-batch-latency-ms" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-client-transfer-stream" )) {
+            my->transfer_stream = options.at( "grpc-client-transfer-stream" ).as<bool>();
+         }
+         if( options.count( "grpc-client-backfill-from" )) {
+            my->backfill_from = options.at( "grpc-client-backfill-from" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-client-backfill-threads" )) {
+            my->backfill_threads = options.at( "grpc-client-backfill-threads" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-client-backfill-chunk-blocks" )) {
+            my->backfill_chunk_blocks = options.at( "grpc-client-backfill-chunk-blocks" ).as<uint32_t>();
+            EOS_ASSERT( my->backfill_chunk_blocks > 0, chain::plugin_config_exception, "grpc-client-backfill-chunk-blocks > 0 required" );
+         }
+         if( options.count( "grpc-client-head-stream" )) {
+            my->head_stream = options.at( "grpc-client-head-stream" ).as<bool>();
+         }
+         if( options.count( "grpc-client-trace-stream" )) {
+            my->trace_stream = options.at( "grpc-client-trace-stream" ).as<bool>();
+         }
+         if( options.count( "grpc-client-filter-on" )) {
+            for( const auto& rule : options.at( "grpc-client-filter-on" ).as<std::vector<std::string>>() )
+               my->transaction_filter.add_include( rule );
+         }
+         if( options.count( "grpc-client-filter-out" )) {
+            for( const auto& rule : options.at( "grpc-client-filter-out" ).as<std::vector<std::string>>() )
+               my->transaction_filter.add_exclude( rule );
+         }
          my->abi_serializer_max_time = app().get_plugin<chain_plugin>().get_abi_serializer_max_time();
+         if( options.count( "grpc-abi-cache-shards" )) {
+            my->abi_cache_shards = options.at( "grpc-abi-cache-shards" ).as<uint32_t>();
+         }
+         my->abi_cache_index.configure( my->abi_cache_size, my->abi_cache_shards, my->abi_serializer_max_time );
+         if( options.count( "grpc-abi-cache-snapshot" )) {
+            const auto& snapshot = options.at( "grpc-abi-cache-snapshot" ).as<std::string>();
+            if( !snapshot.empty() ) {
+               my->abi_cache_snapshot = snapshot;
+               if( my->abi_cache_snapshot.is_relative() )
+                  my->abi_cache_snapshot = app().data_dir() / my->abi_cache_snapshot;
+            }
+         }
 
 // hook up to signals on controller
          chain_plugin* chain_plug = app().find_plugin<chain_plugin>();
@@ -667,9 +2707,22 @@ void grpc_client_plugin::plugin_initialize(const variables_map& options)
          auto& chain = chain_plug->chain();
          //my->chain_id.emplace( chain.get_chain_id());
 
-         my->accepted_block_connection.emplace( chain.accepted_block.connect( [&]( const chain::block_state_ptr& bs ) {
-            my->accepted_block( bs );
-         } ));
+         // also reads the blocks between a backfill or a recovered spool and the live stream
+         if( my->memory_policy == memory_overflow_policy::spill || my->backfill_from > 0 || !my->spool_dir.empty() )
+            my->spill_reader.open( chain.get_config().blocks_dir );
+         if( my->backfill_from > 0 ) {
+            my->backfill_reader.open( chain.get_config().blocks_dir );
+            my->next_backfill_block = std::max( my->backfill_from, my->backfill_reader.first_block_num() );
+            if( my->next_backfill_block != my->backfill_from )
+               wlog( "grpc_client block log starts at block ${b}, backfilling from there", ("b", my->next_backfill_block.load()) );
+            my->backfilling = true;
+         }
+
+         if( my->head_stream || my->trace_stream ) {
+            my->accepted_block_connection.emplace( chain.accepted_block.connect( [&]( const chain::block_state_ptr& bs ) {
+               my->accepted_block( bs );
+            } ));
+         }
          my->irreversible_block_connection.emplace(
                chain.irreversible_block.connect( [&]( const chain::block_state_ptr& bs ) {
                   my->applied_irreversible_block( bs );
@@ -678,10 +2731,12 @@ void grpc_client_plugin::plugin_initialize(const variables_map& options)
                chain.accepted_transaction.connect( [&]( const chain::transaction_metadata_ptr& t ) {
                   my->accepted_transaction( t );
                } ));
-         my->applied_transaction_connection.emplace(
-               chain.applied_transaction.connect( [&]( const chain::transaction_trace_ptr& t ) {
-                  my->applied_transaction( t );
-               } ));
+         if( my->trace_stream ) {
+            my->applied_transaction_connection.emplace(
+                  chain.applied_transaction.connect( [&]( const chain::transaction_trace_ptr& t ) {
+                     my->applied_transaction( t );
+                  } ));
+         }
 
             my->init();
          } 
@@ -694,9 +2749,21 @@ void grpc_client_plugin::plugin_startup()
 {
 }
 
+metrics_report grpc_client_plugin::metrics() const
+{
+   std::lock_guard<std::mutex> lock( metrics_mtx );
+   return my ? my->report_metrics() : metrics_report();
+}
+
 void grpc_client_plugin::plugin_shutdown()
 {
-   my.reset();
+   grpc_client_plugin_impl_ptr impl;
+   {
+      std::lock_guard<std::mutex> lock( metrics_mtx );
+      impl.swap( my );
+   }
+   // flushing and joining the export threads can take a while, metrics() does not wait for it
+   impl.reset();
 }
 
 
@@ -0,0 +1,239 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/grpc_client_plugin/json_writer.hpp>
+#include <eosio/chain/abi_serializer.hpp>
+#include <eosio/chain/types.hpp>
+
+#include <fc/io/raw.hpp>
+#include <fc/filesystem.hpp>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace eosio {
+
+/**
+ * Cheap handle handed to abi_serializer::to_variant resolvers in place of
+ * optional<abi_serializer>, so a cache hit does not copy the serializer.
+ */
+struct abi_serializer_ref {
+   std::shared_ptr<const chain::abi_serializer> ptr;
+   std::shared_ptr<const abi_json_schema>       json; ///< for write_transaction_json, may be null with a valid ptr
+
+   bool valid()const { return static_cast<bool>( ptr ); }
+   const chain::abi_serializer* operator->()const { return ptr.get(); }
+   const chain::abi_serializer& operator*()const { return *ptr; }
+};
+
+/**
+ * LRU cache of contract abis, sharded by account so serializer threads rarely contend.
+ * Entries keep the packed abi so the cache can be snapshotted; the abi_serializer is
+ * built on first use, outside the shard lock. An entry with an empty abi records an account
+ * known to have none.
+ */
+class abi_cache {
+public:
+   abi_cache( size_t capacity = 2048, size_t shard_count = 8, fc::microseconds max_time = fc::microseconds() ) {
+      configure( capacity, shard_count, max_time );
+   }
+
+   /// must be called before the cache is used
+   void configure( size_t capacity, size_t shard_count, fc::microseconds max_time ) {
+      shard_count = std::max<size_t>( shard_count, 1 );
+      shards.clear();
+      for( size_t i = 0; i < shard_count; ++i ) {
+         shards.emplace_back( new shard );
+         shards.back()->capacity = std::max<size_t>( (capacity + shard_count - 1) / shard_count, 1 );
+      }
+      max_serialization_time = max_time;
+   }
+
+   /**
+    * @return false on a miss, true with an invalid ref for an account known to have no abi
+    */
+   bool lookup( const account_name& n, abi_serializer_ref& out ) {
+      auto& s = get_shard( n );
+      for( ;; ) {
+         chain::bytes abi;
+         uint64_t version = 0;
+         {
+            std::lock_guard<std::mutex> lock( s.mtx );
+            auto itr = s.index.find( n.value );
+            if( itr == s.index.end() )
+               return false;
+            s.lru.splice( s.lru.begin(), s.lru, itr->second );
+            const auto& e = *itr->second;
+            if( e.serializer || e.abi.empty() ) {
+               out.ptr = e.serializer;
+               out.json = e.json;
+               return true;
+            }
+            abi = e.abi;
+            version = e.version;
+         }
+
+         // a large abi takes a while, other accounts of the shard are looked up meanwhile
+         std::shared_ptr<const chain::abi_serializer> serializer;
+         std::shared_ptr<const abi_json_schema> json;
+         try {
+            chain::abi_def def = fc::raw::unpack<chain::abi_def>( abi );
+            serializer = std::make_shared<const chain::abi_serializer>( def, max_serialization_time );
+            json = std::make_shared<const abi_json_schema>( def, *serializer );
+         } FC_CAPTURE_AND_LOG((n))
+
+         std::lock_guard<std::mutex> lock( s.mtx );
+         auto itr = s.index.find( n.value );
+         if( itr == s.index.end() )
+            return false;
+         auto& e = *itr->second;
+         // replaced or evicted while building, start over with what is there now
+         if( e.version != version )
+            continue;
+         if( !e.serializer ) {
+            e.serializer = std::move( serializer );
+            e.json = std::move( json );
+            if( !e.serializer )
+               e.abi.clear(); // unusable abi, remember the account as having none
+         }
+         out.ptr = e.serializer;
+         out.json = e.json;
+         return true;
+      }
+   }
+
+   /// insert or replace the abi of an account, an empty abi marks it as having none
+   void set( const account_name& n, chain::bytes abi ) {
+      auto& s = get_shard( n );
+      std::lock_guard<std::mutex> lock( s.mtx );
+      auto itr = s.index.find( n.value );
+      if( itr != s.index.end() ) {
+         s.lru.erase( itr->second );
+         s.index.erase( itr );
+      }
+      while( s.lru.size() >= s.capacity ) {
+         s.index.erase( s.lru.back().account.value );
+         s.lru.pop_back();
+      }
+      s.lru.push_front( entry{ n, std::move( abi ), nullptr, nullptr, ++s.versions } );
+      s.index[n.value] = s.lru.begin();
+   }
+
+   void erase( const account_name& n ) {
+      auto& s = get_shard( n );
+      std::lock_guard<std::mutex> lock( s.mtx );
+      auto itr = s.index.find( n.value );
+      if( itr != s.index.end() ) {
+         s.lru.erase( itr->second );
+         s.index.erase( itr );
+      }
+   }
+
+   size_t size() const {
+      size_t n = 0;
+      for( const auto& s : shards ) {
+         std::lock_guard<std::mutex> lock( s->mtx );
+         n += s->lru.size();
+      }
+      return n;
+   }
+
+   /**
+    * Snapshot layout: magic, entry count, then per entry the account, the abi size and the packed abi.
+    * Written to a temporary file and renamed so a crash never leaves a torn snapshot.
+    */
+   void save( const fc::path& file ) const {
+      const fc::path tmp = file.string() + ".tmp";
+      {
+         std::ofstream out( tmp.generic_string(), std::ios::binary | std::ios::trunc );
+         FC_ASSERT( out.good(), "unable to open abi cache snapshot ${f}", ("f", tmp) );
+         uint64_t magic = snapshot_magic;
+         uint32_t count = 0;
+         out.write( reinterpret_cast<const char*>( &magic ), sizeof( magic ));
+         out.write( reinterpret_cast<const char*>( &count ), sizeof( count ));
+         for( const auto& s : shards ) {
+            std::lock_guard<std::mutex> lock( s->mtx );
+            // least recently used first so a smaller cache loading it keeps the hottest entries
+            for( auto itr = s->lru.rbegin(); itr != s->lru.rend(); ++itr ) {
+               const uint64_t account = itr->account.value;
+               const uint32_t size = itr->abi.size();
+               out.write( reinterpret_cast<const char*>( &account ), sizeof( account ));
+               out.write( reinterpret_cast<const char*>( &size ), sizeof( size ));
+               out.write( itr->abi.data(), size );
+               ++count;
+            }
+         }
+         out.seekp( sizeof( magic ));
+         out.write( reinterpret_cast<const char*>( &count ), sizeof( count ));
+         FC_ASSERT( out.good(), "failed writing abi cache snapshot ${f}", ("f", tmp) );
+      }
+      fc::rename( tmp, file );
+   }
+
+   /// @return number of entries loaded, serializers are only built when an entry is first used
+   size_t load( const fc::path& file ) {
+      if( !fc::exists( file ) || fc::file_size( file ) < sizeof( uint64_t ) + sizeof( uint32_t ))
+         return 0;
+      boost::iostreams::mapped_file_source mapped( file.generic_string() );
+      const char* pos = mapped.data();
+      const char* end = pos + mapped.size();
+      uint64_t magic = 0;
+      uint32_t count = 0;
+      memcpy( &magic, pos, sizeof( magic )); pos += sizeof( magic );
+      memcpy( &count, pos, sizeof( count )); pos += sizeof( count );
+      FC_ASSERT( magic == snapshot_magic, "unexpected abi cache snapshot format in ${f}", ("f", file) );
+      size_t loaded = 0;
+      for( uint32_t i = 0; i < count; ++i ) {
+         uint64_t account = 0;
+         uint32_t size = 0;
+         FC_ASSERT( end - pos >= (ptrdiff_t)(sizeof( account ) + sizeof( size )), "truncated abi cache snapshot ${f}", ("f", file) );
+         memcpy( &account, pos, sizeof( account )); pos += sizeof( account );
+         memcpy( &size, pos, sizeof( size )); pos += sizeof( size );
+         FC_ASSERT( end - pos >= (ptrdiff_t)size, "truncated abi cache snapshot ${f}", ("f", file) );
+         set( account_name( account ), chain::bytes( pos, pos + size ));
+         pos += size;
+         ++loaded;
+      }
+      return loaded;
+   }
+
+private:
+   static constexpr uint64_t snapshot_magic = 0x3149424143505247ull; // "GRPCABI1"
+
+   struct entry {
+      account_name                                   account;
+      chain::bytes                                   abi;
+      std::shared_ptr<const chain::abi_serializer>   serializer;
+      std::shared_ptr<const abi_json_schema>         json;
+      uint64_t                                       version = 0; ///< tells a replaced entry apart while its serializer is built
+   };
+
+   struct shard {
+      mutable std::mutex                                               mtx;
+      std::list<entry>                                                 lru;
+      std::unordered_map<uint64_t, std::list<entry>::iterator>         index;
+      size_t                                                           capacity = 1;
+      uint64_t                                                         versions = 0;
+   };
+
+   shard& get_shard( const account_name& n ) {
+      // account names are base32 in the high bits, mix them so neighbours spread over shards
+      const uint64_t h = n.value * 0x9E3779B97F4A7C15ull;
+      return *shards[(h >> 32) % shards.size()];
+   }
+
+   std::vector<std::unique_ptr<shard>>   shards;
+   fc::microseconds                      max_serialization_time;
+};
+
+}
@@ -0,0 +1,195 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/chain/exceptions.hpp>
+#include <eosio/chain/transaction.hpp>
+#include <eosio/chain/types.hpp>
+
+#include <boost/algorithm/string.hpp>
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace eosio {
+
+/**
+ * Include and exclude rules on contract:action:actor, any part blank or * for all, compiled
+ * into one hash map per combination of wildcards in use. A small bloom filter on the contract
+ * rejects most actions before any map is probed.
+ *
+ * A transaction passes when at least one of its actions matches an include rule (or there are
+ * none) and no exclude rule. Thread safe once all rules are added.
+ */
+class action_filter {
+public:
+   struct rule_stats {
+      std::string rule;
+      bool        include;
+      uint64_t    matched; ///< actions matching the rule
+      uint64_t    dropped; ///< transactions dropped because of it
+   };
+
+   void add_include( const std::string& rule ) { add( rule, true ); }
+   void add_exclude( const std::string& rule ) { add( rule, false ); }
+
+   bool empty() const { return rules.empty(); }
+
+   /// @return true if trx should be exported
+   bool accept( const chain::transaction& trx ) {
+      checked.fetch_add( 1, std::memory_order_relaxed );
+      if( trx.actions.empty() )
+         return true;
+      size_t reason = npos;
+      for( size_t i = 0; i < trx.actions.size(); ++i ) {
+         const auto& act = trx.actions[i];
+         size_t include = npos;
+         if( !includes.empty ) {
+            include = match( includes, act );
+            if( include == npos ) {
+               if( i == 0 ) reason = not_included;
+               continue;
+            }
+         }
+         const size_t exclude = match( excludes, act );
+         if( exclude != npos ) {
+            rules[exclude].matched.fetch_add( 1, std::memory_order_relaxed );
+            if( i == 0 ) reason = exclude;
+            continue;
+         }
+         if( include != npos )
+            rules[include].matched.fetch_add( 1, std::memory_order_relaxed );
+         return true;
+      }
+      // the first action decides which rule gets the credit
+      filtered.fetch_add( 1, std::memory_order_relaxed );
+      if( reason == not_included )
+         dropped_not_included.fetch_add( 1, std::memory_order_relaxed );
+      else if( reason != npos )
+         rules[reason].dropped.fetch_add( 1, std::memory_order_relaxed );
+      return false;
+   }
+
+   std::vector<rule_stats> stats() const {
+      std::vector<rule_stats> result;
+      for( const auto& r : rules )
+         result.push_back( rule_stats{ r.text, r.include, r.matched.load(), r.dropped.load() } );
+      return result;
+   }
+
+   uint64_t checked_count() const { return checked.load( std::memory_order_relaxed ); }
+   uint64_t filtered_count() const { return filtered.load( std::memory_order_relaxed ); }
+   /// transactions dropped because none of the include rules matched
+   uint64_t not_included_count() const { return dropped_not_included.load( std::memory_order_relaxed ); }
+
+private:
+   static constexpr size_t npos = size_t(-1);
+   static constexpr size_t not_included = size_t(-2);
+
+   enum : uint32_t { with_contract = 1, with_action = 2, with_actor = 4 };
+
+   struct key {
+      uint64_t contract;
+      uint64_t action;
+      uint64_t actor;
+      bool operator==( const key& k ) const { return contract == k.contract && action == k.action && actor == k.actor; }
+   };
+   struct key_hash {
+      size_t operator()( const key& k ) const {
+         uint64_t h = k.contract * 0x9E3779B97F4A7C15ull;
+         h ^= (k.action + 0x7F4A7C15ull + (h << 6) + (h >> 2)) * 0xBF58476D1CE4E5B9ull;
+         h ^= (k.actor + 0x7F4A7C15ull + (h << 6) + (h >> 2)) * 0x94D049BB133111EBull;
+         return h ^ (h >> 31);
+      }
+   };
+
+   struct rule {
+      std::string             text;
+      bool                    include;
+      std::atomic<uint64_t>   matched{0};
+      std::atomic<uint64_t>   dropped{0};
+   };
+
+   struct rule_set {
+      std::array<std::unordered_map<key, size_t, key_hash>, 8> by_mask;
+      uint32_t                  masks = 0;    ///< bit per wildcard combination in use
+      std::array<uint64_t, 4>   bloom{{0, 0, 0, 0}};
+      bool                      any_contract = false;
+      bool                      empty = true;
+   };
+
+   static uint32_t bloom_bit( uint64_t contract ) {
+      return (contract * 0x9E3779B97F4A7C15ull) >> 56;
+   }
+
+   void add( const std::string& text, bool include ) {
+      std::vector<std::string> parts;
+      boost::split( parts, text, boost::is_any_of( ":" ));
+      EOS_ASSERT( parts.size() <= 3, chain::plugin_config_exception, "Invalid filter ${r}, expected contract:action:actor", ("r", text));
+      parts.resize( 3 );
+      auto to_name = []( const std::string& s ) {
+         return s.empty() || s == "*" ? uint64_t(0) : chain::name( s ).value;
+      };
+      const key k{ to_name( parts[0] ), to_name( parts[1] ), to_name( parts[2] ) };
+      const uint32_t mask = (k.contract ? with_contract : 0) | (k.action ? with_action : 0) | (k.actor ? with_actor : 0);
+
+      auto& set = include ? includes : excludes;
+      set.by_mask[mask].emplace( k, rules.size() );
+      set.masks |= 1u << mask;
+      set.empty = false;
+      if( k.contract ) {
+         const auto bit = bloom_bit( k.contract );
+         set.bloom[bit / 64] |= uint64_t(1) << (bit % 64);
+      } else {
+         set.any_contract = true;
+      }
+      rules.emplace_back();
+      rules.back().text = text;
+      rules.back().include = include;
+   }
+
+   /// @return index of a matching rule or npos
+   size_t match( const rule_set& set, const chain::action& act ) const {
+      if( set.empty )
+         return npos;
+      const uint64_t contract = act.account.value;
+      const auto bit = bloom_bit( contract );
+      const bool maybe_contract = (set.bloom[bit / 64] >> (bit % 64)) & 1;
+      if( !maybe_contract && !set.any_contract )
+         return npos;
+      for( uint32_t mask = 0; mask < 8; ++mask ) {
+         if( !(set.masks & (1u << mask)) || ((mask & with_contract) && !maybe_contract) )
+            continue;
+         const auto& index = set.by_mask[mask];
+         key k{ mask & with_contract ? contract : 0, mask & with_action ? act.name.value : 0, 0 };
+         if( mask & with_actor ) {
+            for( const auto& auth : act.authorization ) {
+               k.actor = auth.actor.value;
+               auto itr = index.find( k );
+               if( itr != index.end() )
+                  return itr->second;
+            }
+         } else {
+            auto itr = index.find( k );
+            if( itr != index.end() )
+               return itr->second;
+         }
+      }
+      return npos;
+   }
+
+   std::deque<rule>        rules; ///< deque so the counters never move
+   rule_set                includes;
+   rule_set                excludes;
+   std::atomic<uint64_t>   checked{0};
+   std::atomic<uint64_t>   filtered{0};
+   std::atomic<uint64_t>   dropped_not_included{0};
+};
+
+}
@@ -0,0 +1,104 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <google/protobuf/arena.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+namespace eosio {
+
+/**
+ * Recycles protobuf arenas for export messages. An arena starts with a small block and doubles
+ * its blocks up to max_block_size, so building a message costs a few allocations instead of one
+ * per field while a small or empty block only holds a few KiB; batches keep many of them alive.
+ * A released arena is Reset(), which frees its blocks, and handed out again.
+ * Arenas may outlive the pool.
+ */
+class arena_pool {
+public:
+   using arena_ptr = std::shared_ptr<google::protobuf::Arena>;
+
+   explicit arena_pool( size_t start_block_size = 4096, size_t max_block_size = 4 * 1024 * 1024, size_t max_pooled = 64 )
+   : shared( std::make_shared<state>() ) {
+      shared->start_block_size = std::max<size_t>( start_block_size, 256 );
+      shared->max_block_size = std::max( max_block_size, shared->start_block_size );
+      shared->max_pooled = max_pooled;
+   }
+
+   /// an empty arena, returned to the pool once the last reference is gone
+   arena_ptr get() {
+      std::unique_ptr<slot> s;
+      {
+         std::lock_guard<std::mutex> lock( shared->mtx );
+         if( !shared->free.empty() ) {
+            s = std::move( shared->free.back() );
+            shared->free.pop_back();
+         }
+      }
+      if( !s )
+         s = shared->make_slot();
+      auto* arena = s->arena.get();
+      {
+         std::lock_guard<std::mutex> lock( shared->mtx );
+         shared->live.insert( arena );
+      }
+      auto st = shared;
+      return arena_ptr( arena, [st, s = s.release()]( google::protobuf::Arena* ) {
+         std::unique_ptr<slot> owned( s );
+         {
+            std::lock_guard<std::mutex> lock( st->mtx );
+            st->live.erase( owned->arena.get() );
+         }
+         owned->arena->Reset();
+         std::lock_guard<std::mutex> lock( st->mtx );
+         if( st->free.size() < st->max_pooled )
+            st->free.emplace_back( std::move( owned ));
+      } );
+   }
+
+   /// memory held by arenas handed out and not yet released, i.e. messages being built or sent
+   uint64_t bytes_in_use() const {
+      std::lock_guard<std::mutex> lock( shared->mtx );
+      uint64_t bytes = 0;
+      for( const auto* arena : shared->live )
+         bytes += arena->SpaceAllocated();
+      return bytes;
+   }
+
+private:
+   struct slot {
+      std::unique_ptr<google::protobuf::Arena>   arena;
+   };
+
+   struct state {
+      std::unique_ptr<slot> make_slot() const {
+         std::unique_ptr<slot> s( new slot );
+         // no initial block, the first block is only allocated with the first message
+         google::protobuf::ArenaOptions options;
+         options.start_block_size = start_block_size;
+         options.max_block_size = max_block_size;
+         s->arena.reset( new google::protobuf::Arena( options ));
+         return s;
+      }
+
+      mutable std::mutex                  mtx;
+      std::vector<std::unique_ptr<slot>>  free;
+      std::unordered_set<const google::protobuf::Arena*> live;
+      size_t                              start_block_size = 0;
+      size_t                              max_block_size = 0;
+      size_t                              max_pooled = 0;
+   };
+
+   std::shared_ptr<state> shared;
+};
+
+}
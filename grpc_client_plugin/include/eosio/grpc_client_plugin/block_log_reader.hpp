@@ -0,0 +1,132 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/chain/block.hpp>
+#include <eosio/chain/exceptions.hpp>
+
+#include <fc/exception/exception.hpp>
+#include <fc/filesystem.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+namespace eosio {
+
+/**
+ * Read-only access to the node's blocks.log through blocks.index, used to backfill history.
+ * chain::block_log is not used because it opens the files for writing and the controller
+ * already has them open. The log may keep growing while it is read.
+ *
+ * Every log entry is a packed signed_block followed by its uint64 start position, and index
+ * entry i holds the start position of block first_block_num() + i.
+ */
+class block_log_reader {
+public:
+   void open( const fc::path& blocks_dir ) {
+      log_path = blocks_dir / "blocks.log";
+      index_path = blocks_dir / "blocks.index";
+      EOS_ASSERT( fc::exists( log_path ) && fc::exists( index_path ), chain::plugin_config_exception,
+                  "backfill needs ${l} and ${i}", ("l", log_path)("i", index_path));
+      log.open( log_path.generic_string(), std::ios::in | std::ios::binary );
+      index.open( index_path.generic_string(), std::ios::in | std::ios::binary );
+      EOS_ASSERT( log && index, chain::plugin_config_exception, "unable to open ${l} for reading", ("l", log_path));
+      uint32_t version = 0;
+      log.read( reinterpret_cast<char*>( &version ), sizeof( version ));
+      EOS_ASSERT( log && version > 0, chain::plugin_config_exception, "${l} has no valid header", ("l", log_path));
+      // version 1 logs always start at block 1, later versions record the first block
+      first = 1;
+      if( version > 1 )
+         log.read( reinterpret_cast<char*>( &first ), sizeof( first ));
+   }
+
+   uint32_t first_block_num() const { return first; }
+
+   /// last block that is completely in the log, first_block_num() - 1 if there is none
+   uint32_t last_block_num() const {
+      return first + uint32_t( fc::file_size( index_path ) / sizeof( uint64_t )) - 1;
+   }
+
+   /**
+    * Reads blocks from..to, which must be in the log, with one sequential read. Block
+    * from + i is at buffer[offsets[i]] up to buffer[offsets[i + 1]], trailing position included.
+    */
+   void read( uint32_t from, uint32_t to, std::vector<char>& buffer, std::vector<uint64_t>& offsets ) {
+      FC_ASSERT( from >= first && from <= to && to <= last_block_num(), "blocks ${f}-${t} are not in the block log", ("f", from)("t", to));
+      // the start of the block after to is its end; the last indexed block has no next index entry
+      const bool tail = to == last_block_num();
+      offsets.resize( to - from + 2 );
+      const size_t entries = to - from + (tail ? 1 : 2);
+      index.clear();
+      index.seekg( uint64_t( from - first ) * sizeof( uint64_t ));
+      index.read( reinterpret_cast<char*>( offsets.data() ), entries * sizeof( uint64_t ));
+      FC_ASSERT( index, "unable to read ${i}", ("i", index_path));
+
+      const uint64_t start = offsets.front();
+      // the log may already hold blocks the index does not, so the tail is read up to the end of
+      // the file and cut after the last indexed block once it is decoded
+      const uint64_t end = tail ? fc::file_size( log_path ) : offsets.back();
+      FC_ASSERT( end > start, "corrupt block log index at block ${b}", ("b", from));
+      buffer.resize( end - start );
+      log.clear();
+      log.seekg( start );
+      log.read( buffer.data(), buffer.size() );
+      FC_ASSERT( log, "unable to read blocks ${f}-${t} from ${l}", ("f", from)("t", to)("l", log_path));
+      for( auto& o : offsets )
+         o -= start;
+      if( tail ) {
+         offsets.back() = entry_end( buffer, offsets[offsets.size() - 2], start, to );
+         buffer.resize( offsets.back() );
+      }
+   }
+
+   /// one block, waiting up to timeout for it to reach the log
+   chain::signed_block_ptr read_block( uint32_t num, std::chrono::milliseconds timeout ) {
+      const auto deadline = std::chrono::steady_clock::now() + timeout;
+      while( num > last_block_num() && std::chrono::steady_clock::now() < deadline )
+         std::this_thread::sleep_for( std::chrono::milliseconds( 10 ));
+      read( num, num, block_buffer, block_offsets );
+      return unpack( block_buffer.data(), block_offsets[1], num );
+   }
+
+   /// the packed block at data, which must be block num
+   static chain::signed_block_ptr unpack( const char* data, size_t size, uint32_t num ) {
+      fc::datastream<const char*> ds( data, size );
+      auto block = std::make_shared<chain::signed_block>();
+      fc::raw::unpack( ds, *block );
+      FC_ASSERT( block->block_num() == num, "block log has block ${n} where ${e} was expected", ("n", block->block_num())("e", num));
+      return block;
+   }
+
+private:
+   /// end of the entry of block num at buffer[pos], checked against the position written after it
+   static uint64_t entry_end( const std::vector<char>& buffer, uint64_t pos, uint64_t buffer_start, uint32_t num ) {
+      FC_ASSERT( pos < buffer.size(), "block ${b} is not in the block log", ("b", num));
+      fc::datastream<const char*> ds( buffer.data() + pos, buffer.size() - pos );
+      chain::signed_block block;
+      fc::raw::unpack( ds, block );
+      const uint64_t block_end = pos + ds.tellp();
+      uint64_t position = 0;
+      FC_ASSERT( block_end + sizeof( position ) <= buffer.size(), "block ${b} is incomplete in the block log", ("b", num));
+      memcpy( &position, buffer.data() + block_end, sizeof( position ));
+      FC_ASSERT( position == buffer_start + pos, "block log entry of block ${b} ends in position ${p}, expected ${e}",
+                 ("b", num)("p", position)("e", buffer_start + pos));
+      return block_end + sizeof( position );
+   }
+
+   fc::path        log_path;
+   fc::path        index_path;
+   std::ifstream   log;
+   std::ifstream   index;
+   uint32_t        first = 1;
+   std::vector<char>      block_buffer;
+   std::vector<uint64_t>  block_offsets;
+};
+
+}
@@ -0,0 +1,54 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/chain/block.hpp>
+#include <eosio/chain/transaction.hpp>
+
+#include <fc/io/raw.hpp>
+
+#include "block.pb.h"
+
+namespace eosio {
+
+/// id of a block transaction receipt without unpacking it, only zlib compressed ones are inflated
+inline chain::transaction_id_type receipt_id( const chain::transaction_receipt& receipt ) {
+   if( receipt.trx.contains<chain::transaction_id_type>() )
+      return receipt.trx.get<chain::transaction_id_type>();
+   // the id is the digest of the uncompressed transaction, only zlib needs the extra copy
+   const auto& pt = receipt.trx.get<chain::packed_transaction>();
+   if( pt.compression == chain::packed_transaction::none )
+      return chain::transaction_id_type::hash( pt.packed_trx.data(), pt.packed_trx.size() );
+   const auto raw = pt.get_raw_transaction();
+   return chain::transaction_id_type::hash( raw.data(), raw.size() );
+}
+
+/**
+ * Fills the binary fields of a BlockTransRequest from a receipt holding a packed_transaction,
+ * the bytes are copied as stored in the block.
+ * @return the transaction id
+ */
+inline chain::transaction_id_type fill_packed_transaction( const chain::transaction_receipt& receipt,
+                                                           force_block::BlockTransRequest& out ) {
+   const auto& pt = receipt.trx.get<chain::packed_transaction>();
+   out.set_packed_trx( pt.packed_trx.data(), pt.packed_trx.size() );
+   out.set_compression( static_cast<uint32_t>( pt.compression.value ));
+   for( const auto& sig : pt.signatures ) {
+      // packed straight into the field, no temporary buffer
+      auto* packed_sig = out.add_signatures();
+      packed_sig->resize( fc::raw::pack_size( sig ));
+      fc::datastream<char*> ds( &(*packed_sig)[0], packed_sig->size() );
+      fc::raw::pack( ds, sig );
+   }
+   out.set_packed_context_free_data( pt.packed_context_free_data.data(), pt.packed_context_free_data.size() );
+   const auto id = receipt_id( receipt );
+   out.set_id( id.data(), id.data_size() );
+   out.set_status( static_cast<uint32_t>( receipt.status.value ));
+   out.set_cpu_usage_us( receipt.cpu_usage_us );
+   out.set_net_usage_words( receipt.net_usage_words.value );
+   return id;
+}
+
+}
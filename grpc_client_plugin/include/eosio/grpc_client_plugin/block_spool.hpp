@@ -0,0 +1,311 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <fc/exception/exception.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/log/logger.hpp>
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace eosio {
+
+/**
+ * Durable queue of serialized block exports between the consume thread and the sender.
+ *
+ * Records are appended to numbered segment files, each record being
+ * [payload size][block num][crc32 of payload][payload]. The sender reads them back in order and
+ * acknowledges block numbers as the server confirms them; the last acknowledged block is kept in
+ * a checkpoint file and segments that are fully acknowledged are deleted. On open a torn record
+ * at the tail is truncated and reading resumes right after the checkpoint.
+ */
+class block_spool {
+public:
+   block_spool() = default;
+   block_spool( const block_spool& ) = delete;
+   block_spool& operator=( const block_spool& ) = delete;
+   ~block_spool() { close(); }
+
+   void open( const fc::path& d, uint64_t max_segment_size ) {
+      dir = d;
+      segment_size = std::max<uint64_t>( max_segment_size, 1024 * 1024 );
+      fc::create_directories( dir );
+
+      const auto checkpoint_file = dir / "checkpoint";
+      checkpoint_fd = ::open( checkpoint_file.generic_string().c_str(), O_RDWR | O_CREAT, 0644 );
+      FC_ASSERT( checkpoint_fd >= 0, "unable to open spool checkpoint ${f}", ("f", checkpoint_file) );
+      uint32_t checkpoint[2] = {0, 0};
+      if( ::pread( checkpoint_fd, checkpoint, sizeof( checkpoint ), 0 ) == sizeof( checkpoint ) && checkpoint[1] == ~checkpoint[0] )
+         acked_block = checkpoint[0];
+
+      std::vector<std::pair<uint64_t, fc::path>> found;
+      for( boost::filesystem::directory_iterator itr( dir ), end; itr != end; ++itr ) {
+         const auto name = itr->path().filename().string();
+         if( name.size() > 12 && name.compare( 0, 8, "segment-" ) == 0 && name.compare( name.size() - 4, 4, ".log" ) == 0 )
+            found.emplace_back( std::stoull( name.substr( 8, name.size() - 12 )), itr->path() );
+      }
+      std::sort( found.begin(), found.end() );
+
+      uint64_t next_seq = 1;
+      for( const auto& f : found ) {
+         segment seg{ f.first, f.second, 0, 0 };
+         scan( seg );
+         next_seq = seg.seq + 1;
+         if( seg.last_block <= acked_block ) {
+            boost::filesystem::remove( seg.file );
+            continue;
+         }
+         spooled_block = std::max( spooled_block, seg.last_block );
+         segments.push_back( seg );
+      }
+      spooled_block = std::max( spooled_block, acked_block );
+
+      // always append to a fresh segment, recovered ones are only read
+      start_segment( next_seq );
+      rewind();
+      ilog( "grpc_client spool ${d} resuming after block ${a}, ${n} blocks spooled up to ${s}",
+            ("d", dir)("a", acked_block)("n", spooled_block - acked_block)("s", spooled_block) );
+   }
+
+   void close() {
+      if( write_fd >= 0 ) {
+         ::fdatasync( write_fd );
+         ::close( write_fd );
+         write_fd = -1;
+      }
+      if( read_fd >= 0 ) {
+         ::close( read_fd );
+         read_fd = -1;
+      }
+      if( checkpoint_fd >= 0 ) {
+         ::fdatasync( checkpoint_fd );
+         ::close( checkpoint_fd );
+         checkpoint_fd = -1;
+      }
+   }
+
+   /// consume thread, @return false if block_num was already spooled
+   bool append( uint32_t block_num, const std::string& payload ) {
+      if( block_num <= spooled_block )
+         return false;
+
+      {
+         std::lock_guard<std::mutex> lock( mtx );
+         if( segments.back().size > 0 && segments.back().size + header_size + payload.size() > segment_size ) {
+            ::fdatasync( write_fd );
+            ::close( write_fd );
+            start_segment( segments.back().seq + 1 );
+         }
+      }
+
+      uint32_t header[3] = { static_cast<uint32_t>( payload.size() ), block_num, crc( payload.data(), payload.size() ) };
+      write_all( header, sizeof( header ));
+      write_all( payload.data(), payload.size() );
+
+      std::lock_guard<std::mutex> lock( mtx );
+      segments.back().size += header_size + payload.size();
+      segments.back().last_block = block_num;
+      spooled_block = block_num;
+      cond.notify_one();
+      return true;
+   }
+
+   /// consume thread, make everything appended so far durable
+   void sync() {
+      if( write_fd >= 0 )
+         ::fdatasync( write_fd );
+   }
+
+   /// sender thread, @return false if nothing arrived within wait
+   bool read_next( uint32_t& block_num, std::string& payload, std::chrono::milliseconds wait ) {
+      for( ;; ) {
+         fc::path file;
+         uint64_t offset = 0;
+         {
+            std::unique_lock<std::mutex> lock( mtx );
+            for( ;; ) {
+               auto seg = find_segment( read_seq );
+               if( seg == segments.end() ) { // deleted under us, start over from the oldest segment
+                  read_seq = segments.front().seq;
+                  read_offset = 0;
+                  continue;
+               }
+               if( read_offset + header_size <= seg->size ) {
+                  file = seg->file;
+                  offset = read_offset;
+                  break;
+               }
+               if( seg->seq != segments.back().seq ) {
+                  read_seq = (seg + 1)->seq;
+                  read_offset = 0;
+                  continue;
+               }
+               if( cond.wait_for( lock, wait ) == std::cv_status::timeout && read_offset + header_size > segments.back().size )
+                  return false;
+            }
+            if( file != read_file ) {
+               if( read_fd >= 0 ) ::close( read_fd );
+               read_fd = ::open( file.generic_string().c_str(), O_RDONLY );
+               read_file = file;
+               FC_ASSERT( read_fd >= 0, "unable to open spool segment ${f}", ("f", file) );
+            }
+         }
+
+         uint32_t header[3];
+         FC_ASSERT( ::pread( read_fd, header, sizeof( header ), offset ) == sizeof( header ), "short read in ${f}", ("f", file) );
+         payload.resize( header[0] );
+         FC_ASSERT( ::pread( read_fd, &payload[0], header[0], offset + header_size ) == (ssize_t)header[0], "short read in ${f}", ("f", file) );
+         FC_ASSERT( crc( payload.data(), payload.size() ) == header[2], "corrupt record in ${f} at ${o}", ("f", file)("o", offset) );
+         block_num = header[1];
+
+         std::lock_guard<std::mutex> lock( mtx );
+         read_offset = offset + header_size + header[0];
+         if( block_num > acked_block )
+            return true;
+      }
+   }
+
+   /// sender thread, blocks up to and including block_num were confirmed by the server
+   void ack( uint32_t block_num ) {
+      std::lock_guard<std::mutex> lock( mtx );
+      if( block_num <= acked_block )
+         return;
+      acked_block = block_num;
+      uint32_t checkpoint[2] = { acked_block, ~acked_block };
+      if( ::pwrite( checkpoint_fd, checkpoint, sizeof( checkpoint ), 0 ) != sizeof( checkpoint ))
+         wlog( "grpc_client unable to write spool checkpoint in ${d}", ("d", dir) );
+      if( ++acks_since_sync >= 64 ) {
+         ::fdatasync( checkpoint_fd );
+         acks_since_sync = 0;
+      }
+      while( segments.size() > 1 && segments.front().last_block <= acked_block ) {
+         boost::filesystem::remove( segments.front().file );
+         segments.pop_front();
+      }
+   }
+
+   /// sender thread, continue reading right after the last acknowledged block
+   void rewind() {
+      std::lock_guard<std::mutex> lock( mtx );
+      read_seq = segments.front().seq;
+      read_offset = 0;
+   }
+
+   /// wake a sender blocked in read_next
+   void notify() {
+      std::lock_guard<std::mutex> lock( mtx );
+      cond.notify_all();
+   }
+
+   uint32_t last_acked_block() const {
+      std::lock_guard<std::mutex> lock( mtx );
+      return acked_block;
+   }
+
+   uint32_t last_spooled_block() const {
+      std::lock_guard<std::mutex> lock( mtx );
+      return spooled_block;
+   }
+
+private:
+   static constexpr uint64_t header_size = 3 * sizeof( uint32_t );
+
+   struct segment {
+      uint64_t   seq;
+      fc::path   file;
+      uint64_t   size;
+      uint32_t   last_block;
+   };
+
+   static uint32_t crc( const char* data, size_t size ) {
+      boost::crc_32_type result;
+      result.process_bytes( data, size );
+      return result.checksum();
+   }
+
+   std::deque<segment>::iterator find_segment( uint64_t seq ) {
+      return std::find_if( segments.begin(), segments.end(), [seq]( const segment& s ) { return s.seq == seq; } );
+   }
+
+   /// find the end of the last complete record, dropping a torn tail left by a crash
+   void scan( segment& seg ) {
+      const int fd = ::open( seg.file.generic_string().c_str(), O_RDWR );
+      FC_ASSERT( fd >= 0, "unable to open spool segment ${f}", ("f", seg.file) );
+      const uint64_t file_size = boost::filesystem::file_size( seg.file );
+      std::string payload;
+      uint64_t offset = 0;
+      while( offset + header_size <= file_size ) {
+         uint32_t header[3];
+         if( ::pread( fd, header, sizeof( header ), offset ) != sizeof( header ) || offset + header_size + header[0] > file_size )
+            break;
+         payload.resize( header[0] );
+         if( ::pread( fd, &payload[0], header[0], offset + header_size ) != (ssize_t)header[0] || crc( payload.data(), payload.size() ) != header[2] )
+            break;
+         seg.last_block = header[1];
+         offset += header_size + header[0];
+      }
+      if( offset != file_size ) {
+         wlog( "grpc_client truncating spool segment ${f} from ${s} to ${o} bytes", ("f", seg.file)("s", file_size)("o", offset) );
+         FC_ASSERT( ::ftruncate( fd, offset ) == 0, "unable to truncate ${f}", ("f", seg.file) );
+      }
+      ::close( fd );
+      seg.size = offset;
+   }
+
+   void start_segment( uint64_t seq ) {
+      char name[32];
+      snprintf( name, sizeof( name ), "segment-%010llu.log", static_cast<unsigned long long>( seq ));
+      segment seg{ seq, dir / name, 0, spooled_block };
+      write_fd = ::open( seg.file.generic_string().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644 );
+      FC_ASSERT( write_fd >= 0, "unable to create spool segment ${f}", ("f", seg.file) );
+      segments.push_back( seg );
+   }
+
+   void write_all( const void* data, size_t size ) {
+      const char* pos = static_cast<const char*>( data );
+      while( size > 0 ) {
+         const ssize_t written = ::write( write_fd, pos, size );
+         FC_ASSERT( written > 0 || errno == EINTR, "unable to write spool segment ${f}", ("f", segments.back().file) );
+         if( written > 0 ) {
+            pos += written;
+            size -= written;
+         }
+      }
+   }
+
+   fc::path                  dir;
+   uint64_t                  segment_size = 64 * 1024 * 1024;
+
+   mutable std::mutex        mtx;
+   std::condition_variable   cond;
+   std::deque<segment>       segments; ///< oldest first, back is being appended to
+
+   int                       write_fd = -1;
+   int                       read_fd = -1;
+   fc::path                  read_file;
+   uint64_t                  read_seq = 0;
+   uint64_t                  read_offset = 0;
+
+   int                       checkpoint_fd = -1;
+   uint32_t                  acks_since_sync = 0;
+   uint32_t                  acked_block = 0;
+   uint32_t                  spooled_block = 0;
+};
+
+}
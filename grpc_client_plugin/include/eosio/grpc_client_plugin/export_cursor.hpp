@@ -0,0 +1,89 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+namespace eosio {
+
+/**
+ * Next irreversible block to export once a backfill handed over to the live stream, or after a
+ * recovered spool. Live blocks exported already are skipped, and the blocks between the start
+ * and the first live one are filled in, so the export has neither gaps nor duplicates.
+ * Until start() every block is exported as it comes.
+ */
+class export_cursor {
+public:
+   void start( uint32_t next_block ) {
+      next = next_block;
+      started = true;
+   }
+
+   bool active() const { return started; }
+   uint32_t next_block() const { return next; }
+
+   /**
+    * Called for live block num before it is exported. fill( n ) is called for every block
+    * missing before num, in order; if it throws, the cursor stays at that block.
+    * @return false if num was exported already
+    */
+   template<typename Fill>
+   bool advance( uint32_t num, Fill&& fill ) {
+      if( !started )
+         return true;
+      if( num < next )
+         return false;
+      for( ; next < num; ++next )
+         fill( next );
+      next = num + 1;
+      return true;
+   }
+
+private:
+   uint32_t  next = 0;
+   bool      started = false;
+};
+
+/**
+ * Live irreversible blocks held back while a backfill reads blocks.log. The backfill runs until it
+ * reaches the first held block, then the held blocks are released through the cursor, which skips
+ * the ones the backfill exported already.
+ */
+template<typename Entry>
+class backfill_handoff {
+public:
+   void hold( Entry e ) { held.push_back( std::move( e )); }
+
+   bool empty() const { return held.empty(); }
+
+   /**
+    * Called with the next block the backfill would export. Once it reached the first held block,
+    * starts cursor there and passes every held entry to release, in order.
+    * @return true if the held blocks were released
+    */
+   template<typename Release>
+   bool try_release( uint32_t next_backfill_block, export_cursor& cursor, Release&& release ) {
+      if( held.empty() || held.front().block_num > next_backfill_block )
+         return false;
+      cursor.start( next_backfill_block );
+      release_all( release );
+      return true;
+   }
+
+   /// passes every held entry to release, in order, and forgets them
+   template<typename Release>
+   void release_all( Release&& release ) {
+      for( const auto& e : held )
+         release( e );
+      held.clear();
+   }
+
+private:
+   std::deque<Entry> held;
+};
+
+}
@@ -0,0 +1,184 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace eosio {
+
+/**
+ * Histogram with power of two buckets, bucket i counting values in [2^(i-1), 2^i).
+ * Writers only touch the shard of their thread with relaxed atomics, readers merge all shards,
+ * so recording never takes a lock and threads rarely share a cache line.
+ */
+class latency_histogram {
+public:
+   static constexpr size_t bucket_count = 48;
+   static constexpr size_t shard_count = 16;
+
+   struct snapshot {
+      std::array<uint64_t, bucket_count> buckets{};
+      uint64_t count = 0;
+      uint64_t sum = 0;
+
+      /// upper bound of the bucket holding the q quantile, 0 when empty
+      uint64_t quantile( double q ) const {
+         const uint64_t rank = static_cast<uint64_t>( std::ceil( q * count ));
+         uint64_t seen = 0;
+         for( size_t i = 0; i < bucket_count; ++i ) {
+            seen += buckets[i];
+            if( seen >= rank && seen > 0 )
+               return upper_bound( i );
+         }
+         return 0;
+      }
+   };
+
+   static uint64_t upper_bound( size_t bucket ) { return uint64_t(1) << bucket; }
+
+   void record( uint64_t value ) {
+      auto& s = shards[this_thread_shard()];
+      const size_t bucket = value == 0 ? 0 : std::min<size_t>( 64 - __builtin_clzll( value ), bucket_count - 1 );
+      s.buckets[bucket].fetch_add( 1, std::memory_order_relaxed );
+      s.sum.fetch_add( value, std::memory_order_relaxed );
+   }
+
+   void record_since( std::chrono::steady_clock::time_point start ) {
+      record( std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - start ).count() );
+   }
+
+   snapshot read() const {
+      snapshot result;
+      for( const auto& s : shards ) {
+         for( size_t i = 0; i < bucket_count; ++i ) {
+            const auto n = s.buckets[i].load( std::memory_order_relaxed );
+            result.buckets[i] += n;
+            result.count += n;
+         }
+         result.sum += s.sum.load( std::memory_order_relaxed );
+      }
+      return result;
+   }
+
+private:
+   struct alignas(64) shard {
+      std::array<std::atomic<uint64_t>, bucket_count> buckets{};
+      std::atomic<uint64_t>                            sum{0};
+   };
+
+   static size_t this_thread_shard() {
+      static std::atomic<size_t> next_shard{0};
+      static thread_local const size_t index = next_shard.fetch_add( 1, std::memory_order_relaxed ) % shard_count;
+      return index;
+   }
+
+   std::array<shard, shard_count> shards;
+};
+
+/// one sample of a metrics_report, histogram values are scaled by scale when reported
+struct metric_sample {
+   enum class kind { counter, gauge, histogram };
+   std::string                   name;
+   std::string                   help;
+   std::string                   labels; ///< prometheus label set without braces, e.g. queue="irreversible"
+   kind                          type = kind::gauge;
+   double                        value = 0;
+   latency_histogram::snapshot   histogram;
+   double                        scale = 1;
+};
+
+/**
+ * Metrics collected at one point in time, rendered in the Prometheus text exposition format
+ * or handed over sample by sample.
+ */
+class metrics_report {
+public:
+   void counter( const std::string& name, const std::string& help, double value, const std::string& labels = std::string() ) {
+      add( name, help, labels, metric_sample::kind::counter ).value = value;
+   }
+   void gauge( const std::string& name, const std::string& help, double value, const std::string& labels = std::string() ) {
+      add( name, help, labels, metric_sample::kind::gauge ).value = value;
+   }
+   void histogram( const std::string& name, const std::string& help, const latency_histogram::snapshot& h, double scale,
+                   const std::string& labels = std::string() ) {
+      auto& s = add( name, help, labels, metric_sample::kind::histogram );
+      s.histogram = h;
+      s.scale = scale;
+   }
+
+   const std::vector<metric_sample>& samples() const { return all; }
+
+   std::string prometheus() const {
+      std::string out;
+      std::set<std::string> described;
+      for( const auto& s : all ) {
+         if( described.insert( s.name ).second ) {
+            out += "# HELP " + s.name + " " + s.help + "\n";
+            out += "# TYPE " + s.name + " " + type_name( s.type ) + "\n";
+         }
+         if( s.type != metric_sample::kind::histogram ) {
+            out += s.name + braces( s.labels ) + " " + number( s.value ) + "\n";
+            continue;
+         }
+         // buckets are cumulative in the exposition format; skip the empty tail
+         size_t last = 0;
+         for( size_t i = 0; i < latency_histogram::bucket_count; ++i )
+            if( s.histogram.buckets[i] ) last = i;
+         uint64_t cumulative = 0;
+         const std::string sep = s.labels.empty() ? "" : ",";
+         for( size_t i = 0; i <= last; ++i ) {
+            cumulative += s.histogram.buckets[i];
+            out += s.name + "_bucket{" + s.labels + sep + "le=\"" + number( latency_histogram::upper_bound( i ) * s.scale ) + "\"} " +
+                   std::to_string( cumulative ) + "\n";
+         }
+         out += s.name + "_bucket{" + s.labels + sep + "le=\"+Inf\"} " + std::to_string( s.histogram.count ) + "\n";
+         out += s.name + "_sum" + braces( s.labels ) + " " + number( s.histogram.sum * s.scale ) + "\n";
+         out += s.name + "_count" + braces( s.labels ) + " " + std::to_string( s.histogram.count ) + "\n";
+      }
+      return out;
+   }
+
+private:
+   metric_sample& add( const std::string& name, const std::string& help, const std::string& labels, metric_sample::kind type ) {
+      all.emplace_back();
+      auto& s = all.back();
+      s.name = name;
+      s.help = help;
+      s.labels = labels;
+      s.type = type;
+      return s;
+   }
+
+   static const char* type_name( metric_sample::kind k ) {
+      switch( k ) {
+         case metric_sample::kind::counter: return "counter";
+         case metric_sample::kind::histogram: return "histogram";
+         default: return "gauge";
+      }
+   }
+
+   static std::string braces( const std::string& labels ) {
+      return labels.empty() ? labels : "{" + labels + "}";
+   }
+
+   static std::string number( double v ) {
+      char buf[32];
+      snprintf( buf, sizeof( buf ), "%.9g", v );
+      return buf;
+   }
+
+   std::vector<metric_sample> all;
+};
+
+}
@@ -5,8 +5,10 @@
 #pragma once
 
 #include <eosio/chain_plugin/chain_plugin.hpp>
+#include <eosio/grpc_client_plugin/export_stats.hpp>
 #include <appbase/application.hpp>
 #include <memory>
+#include <mutex>
 
 namespace eosio {
 
@@ -30,7 +32,11 @@ public:
    void plugin_startup();
    void plugin_shutdown();
 
+   /// export pipeline telemetry, empty unless grpc-client-address is configured; safe from any thread
+   metrics_report metrics() const;
+
 private:
+   mutable std::mutex          metrics_mtx; ///< guards my against plugin_shutdown while metrics() reads it
    grpc_client_plugin_impl_ptr my;
    bool b_need_start = false;
 };
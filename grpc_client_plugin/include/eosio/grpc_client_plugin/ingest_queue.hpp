@@ -0,0 +1,216 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/grpc_client_plugin/export_stats.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace eosio {
+
+/**
+ * Bounded lock-free ring for many producers and a single consumer (Vyukov's bounded queue).
+ * Capacity is rounded up to a power of two.
+ */
+template<typename T>
+class mpsc_ring {
+public:
+   explicit mpsc_ring( size_t capacity ) {
+      size_t cap = 2;
+      while( cap < capacity ) cap <<= 1;
+      mask = cap - 1;
+      cells.reset( new cell[cap] );
+      for( size_t i = 0; i < cap; ++i )
+         cells[i].seq.store( i, std::memory_order_relaxed );
+   }
+
+   bool try_push( const T& v ) {
+      size_t pos = head.load( std::memory_order_relaxed );
+      for( ;; ) {
+         cell& c = cells[pos & mask];
+         const size_t seq = c.seq.load( std::memory_order_acquire );
+         const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+         if( dif == 0 ) {
+            if( head.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ))  {
+               c.value = v;
+               c.seq.store( pos + 1, std::memory_order_release );
+               return true;
+            }
+         } else if( dif < 0 ) {
+            return false; // full
+         } else {
+            pos = head.load( std::memory_order_relaxed );
+         }
+      }
+   }
+
+   /// single consumer only
+   bool try_pop( T& v ) {
+      const size_t pos = tail.load( std::memory_order_relaxed );
+      cell& c = cells[pos & mask];
+      const size_t seq = c.seq.load( std::memory_order_acquire );
+      if( (intptr_t)seq - (intptr_t)(pos + 1) < 0 )
+         return false; // empty
+      v = std::move( c.value );
+      c.value = T();
+      tail.store( pos + 1, std::memory_order_relaxed );
+      c.seq.store( pos + mask + 1, std::memory_order_release );
+      return true;
+   }
+
+   size_t size_approx() const {
+      const size_t h = head.load( std::memory_order_acquire );
+      const size_t t = tail.load( std::memory_order_acquire );
+      return h > t ? h - t : 0;
+   }
+
+   size_t capacity() const { return mask + 1; }
+
+private:
+   struct cell {
+      std::atomic<size_t> seq;
+      T                   value;
+   };
+
+   std::unique_ptr<cell[]>          cells;
+   size_t                           mask = 0;
+   alignas(64) std::atomic<size_t>  head{0};
+   alignas(64) std::atomic<size_t>  tail{0};
+};
+
+enum class queue_overflow_policy {
+   drop,  ///< discard the entry and count it
+   spill, ///< move to an unbounded overflow list until the consumer catches up
+   block  ///< yield until there is room or the block time expires, then drop
+};
+
+/**
+ * Queue between the controller signal handlers and the consume thread. The fast path is a
+ * single push into the ring; the spill list and its mutex are only touched on overflow.
+ * Entries are drained in the order they were pushed, spilled ones included, and carry their
+ * push time so the wait until they are drained can be recorded.
+ */
+template<typename T>
+class ingest_queue {
+public:
+   explicit ingest_queue( size_t capacity = 1024 ) : ring( new mpsc_ring<stamped>( capacity )) {}
+
+   /// must be called before the queue is used, wake is invoked before a push starts waiting for room
+   void configure( size_t capacity, queue_overflow_policy p, std::chrono::microseconds bt,
+                   std::function<void()> wake = std::function<void()>() ) {
+      ring.reset( new mpsc_ring<stamped>( capacity ));
+      policy = p;
+      block_time = bt;
+      wake_consumer = std::move( wake );
+   }
+
+   /// record how long entries waited between push and drain
+   void set_wait_histogram( latency_histogram* h ) { wait_histogram = h; }
+
+   /// @return false if the entry was dropped
+   bool push( const T& e ) {
+      const auto start = std::chrono::steady_clock::now();
+      const bool pushed = _push( stamped{ e, start } );
+      enqueue_ns.fetch_add( std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start ).count(), std::memory_order_relaxed );
+      enqueued.fetch_add( 1, std::memory_order_relaxed );
+      return pushed;
+   }
+
+   /// move everything queued so far to the back of out, consumer thread only
+   size_t drain( std::deque<T>& out ) {
+      size_t n = 0;
+      stamped e;
+      const auto now = std::chrono::steady_clock::now();
+      while( ring->try_pop( e )) {
+         take( e, out, now );
+         ++n;
+      }
+      if( spill_size.load( std::memory_order_acquire ) > 0 ) {
+         std::lock_guard<std::mutex> lock( spill_mtx );
+         n += spill.size();
+         for( auto& s : spill )
+            take( s, out, now );
+         spill.clear();
+         spill_size.store( 0, std::memory_order_release );
+      }
+      return n;
+   }
+
+   bool empty() const { return size() == 0; }
+   size_t size() const { return ring->size_approx() + spill_size.load( std::memory_order_acquire ); }
+
+   uint64_t dropped_count() const { return dropped.load( std::memory_order_relaxed ); }
+   uint64_t spilled_count() const { return spilled.load( std::memory_order_relaxed ); }
+   uint64_t enqueued_count() const { return enqueued.load( std::memory_order_relaxed ); }
+   uint64_t enqueue_time_ns() const { return enqueue_ns.load( std::memory_order_relaxed ); }
+
+private:
+   struct stamped {
+      T                                       value;
+      std::chrono::steady_clock::time_point   pushed;
+   };
+
+   void take( stamped& e, std::deque<T>& out, std::chrono::steady_clock::time_point now ) {
+      if( wait_histogram )
+         wait_histogram->record( std::chrono::duration_cast<std::chrono::nanoseconds>( now - e.pushed ).count() );
+      out.emplace_back( std::move( e.value ));
+   }
+
+   bool _push( const stamped& e ) {
+      // once spilling started, keep spilling until the consumer drained the list to preserve order
+      if( spill_size.load( std::memory_order_acquire ) == 0 && ring->try_push( e ))
+         return true;
+
+      switch( policy ) {
+         case queue_overflow_policy::spill: {
+            std::lock_guard<std::mutex> lock( spill_mtx );
+            spill.emplace_back( e );
+            spill_size.store( spill.size(), std::memory_order_release );
+            spilled.fetch_add( 1, std::memory_order_relaxed );
+            return true;
+         }
+         case queue_overflow_policy::block: {
+            const auto deadline = std::chrono::steady_clock::now() + block_time;
+            if( wake_consumer ) wake_consumer();
+            do {
+               std::this_thread::yield();
+               if( ring->try_push( e ))
+                  return true;
+            } while( std::chrono::steady_clock::now() < deadline );
+            break;
+         }
+         case queue_overflow_policy::drop:
+            break;
+      }
+      dropped.fetch_add( 1, std::memory_order_relaxed );
+      return false;
+   }
+
+   std::unique_ptr<mpsc_ring<stamped>>  ring;
+   queue_overflow_policy          policy = queue_overflow_policy::spill;
+   std::chrono::microseconds      block_time{100000};
+   std::function<void()>          wake_consumer;
+   latency_histogram*             wait_histogram = nullptr;
+
+   std::mutex                     spill_mtx;
+   std::deque<stamped>            spill;
+   std::atomic<size_t>            spill_size{0};
+
+   std::atomic<uint64_t>          dropped{0};
+   std::atomic<uint64_t>          spilled{0};
+   std::atomic<uint64_t>          enqueued{0};
+   std::atomic<uint64_t>          enqueue_ns{0};
+};
+
+}
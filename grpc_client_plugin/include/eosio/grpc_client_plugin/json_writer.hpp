@@ -0,0 +1,563 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/chain/abi_serializer.hpp>
+#include <eosio/chain/asset.hpp>
+#include <eosio/chain/block_timestamp.hpp>
+#include <eosio/chain/transaction.hpp>
+
+#include <fc/io/json.hpp>
+#include <fc/io/raw.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace eosio {
+
+/**
+ * Reusable output buffer for json text, with string escaping, hex and integers formatted the
+ * way fc::json::to_string formats them. Strings are scanned eight bytes at a time and only
+ * chunks holding a character to escape are looked at byte by byte.
+ */
+class json_buffer {
+public:
+   void clear() { buf.clear(); }
+   size_t size() const { return buf.size(); }
+   void truncate( size_t n ) { buf.resize( n ); }
+   const std::string& str() const { return buf; }
+
+   void put( char c ) { buf.push_back( c ); }
+   void put( const char* s, size_t n ) { buf.append( s, n ); }
+   void put( const char* s ) { buf.append( s ); }
+   void put( const std::string& s ) { buf.append( s ); }
+
+   /// quoted and escaped like fc::json: \b \f \n \r \t \\ \" by name, other control characters as \u00xx
+   void string( const char* s, size_t n ) {
+      buf.push_back( '"' );
+      const char* plain = s;
+      const char* p = s;
+      const char* end = s + n;
+      while( p < end ) {
+         if( end - p >= 8 ) {
+            uint64_t w;
+            memcpy( &w, p, sizeof( w ));
+            if( !needs_escape( w )) {
+               p += 8;
+               continue;
+            }
+         }
+         for( const char* chunk_end = std::min( p + 8, end ); p < chunk_end; ++p ) {
+            const unsigned char c = *p;
+            if( c >= 0x20 && c != '"' && c != '\\' )
+               continue;
+            buf.append( plain, p - plain );
+            escape( c );
+            plain = p + 1;
+         }
+      }
+      buf.append( plain, end - plain );
+      buf.push_back( '"' );
+   }
+   void string( const std::string& s ) { string( s.data(), s.size() ); }
+
+   /// quoted lower case hex, as fc::to_hex
+   void hex_string( const char* s, size_t n ) {
+      static const hex_table table;
+      const size_t start = buf.size();
+      buf.resize( start + 2 * n + 2 );
+      char* out = &buf[start];
+      *out++ = '"';
+      for( size_t i = 0; i < n; ++i, out += 2 )
+         memcpy( out, &table.pairs[2 * static_cast<unsigned char>( s[i] )], 2 );
+      *out = '"';
+   }
+   void hex_string( const std::vector<char>& v ) { hex_string( v.data(), v.size() ); }
+
+   void uint( uint64_t v ) {
+      char tmp[20];
+      char* p = tmp + sizeof( tmp );
+      do {
+         *--p = char( '0' + v % 10 );
+         v /= 10;
+      } while( v );
+      buf.append( p, tmp + sizeof( tmp ) - p );
+   }
+   void sint( int64_t v ) {
+      if( v < 0 ) {
+         buf.push_back( '-' );
+         uint( 0 - uint64_t( v ));
+      } else {
+         uint( v );
+      }
+   }
+   /// 64 bit integers beyond 32 bits are quoted, as fc::json::stringify_large_ints_and_doubles does
+   void uint64( uint64_t v ) {
+      if( v <= 0xffffffffull )
+         return uint( v );
+      buf.push_back( '"' );
+      uint( v );
+      buf.push_back( '"' );
+   }
+   void int64( int64_t v ) {
+      if( v <= int64_t( 0xffffffffll ) && v >= -int64_t( 0xffffffffll ))
+         return sint( v );
+      buf.push_back( '"' );
+      sint( v );
+      buf.push_back( '"' );
+   }
+
+   /// quoted name, as name::to_string
+   void name( uint64_t value ) {
+      static const char* charmap = ".12345abcdefghijklmnopqrstuvwxyz";
+      char str[13];
+      for( uint32_t i = 0; i <= 12; ++i ) {
+         str[12 - i] = charmap[value & (i == 0 ? 0x0f : 0x1f)];
+         value >>= (i == 0 ? 4 : 5);
+      }
+      size_t len = 13;
+      while( len > 0 && str[len - 1] == '.' )
+         --len;
+      buf.push_back( '"' );
+      buf.append( str, len );
+      buf.push_back( '"' );
+   }
+
+private:
+   struct hex_table {
+      char pairs[512];
+      hex_table() {
+         static const char* digits = "0123456789abcdef";
+         for( int i = 0; i < 256; ++i ) {
+            pairs[2 * i] = digits[i >> 4];
+            pairs[2 * i + 1] = digits[i & 0x0f];
+         }
+      }
+   };
+
+   /// whether any byte of w is below 0x20, a quote or a backslash
+   static bool needs_escape( uint64_t w ) {
+      const uint64_t ones = 0x0101010101010101ull;
+      const uint64_t highs = 0x8080808080808080ull;
+      const uint64_t quote = w ^ (ones * '"');
+      const uint64_t backslash = w ^ (ones * '\\');
+      return ((( w - ones * 0x20 ) & ~w) | ((quote - ones) & ~quote) | ((backslash - ones) & ~backslash)) & highs;
+   }
+
+   void escape( unsigned char c ) {
+      switch( c ) {
+         case '\b': buf.append( "\\b", 2 ); break;
+         case '\f': buf.append( "\\f", 2 ); break;
+         case '\n': buf.append( "\\n", 2 ); break;
+         case '\r': buf.append( "\\r", 2 ); break;
+         case '\t': buf.append( "\\t", 2 ); break;
+         case '\\': buf.append( "\\\\", 2 ); break;
+         case '"':  buf.append( "\\\"", 2 ); break;
+         default: {
+            static const char* digits = "0123456789abcdef";
+            const char u[6] = { '\\', 'u', '0', '0', digits[c >> 4], digits[c & 0x0f] };
+            buf.append( u, sizeof( u ));
+         }
+      }
+   }
+
+   std::string buf;
+};
+
+/**
+ * The types of one contract abi resolved once into a graph the json writer walks over the packed
+ * action data, following the same rules as abi_serializer::_binary_to_variant, binary extensions
+ * included. Actions reaching a type whose variant form the writer does not reproduce (floats,
+ * 128 bit integers, keys, signatures, bool, duplicate field names) or that does not resolve are
+ * marked as not streamable.
+ */
+class abi_json_schema {
+public:
+   struct type {
+      enum kind_t { builtin, array, optional, variant, structure, failure };
+      enum builtin_t { int8, uint8, int16, uint16, int32, uint32, int64, uint64, varint32, varuint32, name, string, bytes,
+                       checksum160, checksum256, checksum512, symbol, asset, time_point, time_point_sec, block_timestamp, other };
+      kind_t          kind = failure;
+      builtin_t       builtin_type = other;
+      const type*     element = nullptr;
+      std::vector<std::pair<std::string, const type*>> members; ///< struct fields, base fields first, or variant alternatives
+      std::vector<bool> extensions; ///< per struct field, a binary extension (type$) that is left out at the end of the data
+      bool            duplicate_fields = false;
+   };
+
+   struct action_type {
+      std::string     type_name;
+      const type*     root = nullptr;
+      bool            streamable = false;
+   };
+
+   abi_json_schema( const chain::abi_def& abi, const chain::abi_serializer& serializer ) {
+      compiler c{ *this, serializer };
+      for( const auto& t : abi.types )
+         c.typedefs[t.new_type_name] = t.type;
+      for( const auto& s : abi.structs )
+         c.structs[s.name] = &s;
+      for( const auto& v : abi.variants.value )
+         c.variants[v.name] = &v.types;
+      for( const auto& a : abi.actions ) {
+         auto& entry = actions[a.name.value];
+         entry.type_name = a.type;
+         entry.root = a.type.empty() ? nullptr : c.compile( a.type );
+         std::set<const type*> seen;
+         entry.streamable = entry.root && streamable( *entry.root, seen );
+      }
+   }
+
+   /// nullptr when the abi has no such action
+   const action_type* find_action( chain::action_name n ) const {
+      auto itr = actions.find( n.value );
+      return itr == actions.end() ? nullptr : &itr->second;
+   }
+
+   /// writes the value of t read from ds, @return true if it was null
+   bool write( json_buffer& out, const type& t, fc::datastream<const char*>& ds, size_t depth = 0 ) const {
+      FC_ASSERT( ++depth < max_depth, "recursive definition, max_recursion_depth ${r}", ("r", max_depth) );
+      switch( t.kind ) {
+         case type::builtin:
+            write_builtin( out, t.builtin_type, ds );
+            return false;
+         case type::array: {
+            fc::unsigned_int size;
+            fc::raw::unpack( ds, size );
+            out.put( '[' );
+            for( uint32_t i = 0; i < size.value; ++i ) {
+               if( i > 0 )
+                  out.put( ',' );
+               FC_ASSERT( !write( out, *t.element, ds, depth ), "Invalid packed array" );
+            }
+            out.put( ']' );
+            return false;
+         }
+         case type::optional: {
+            char flag;
+            fc::raw::unpack( ds, flag );
+            if( flag )
+               return write( out, *t.element, ds, depth );
+            out.put( "null", 4 );
+            return true;
+         }
+         case type::variant: {
+            fc::unsigned_int select;
+            fc::raw::unpack( ds, select );
+            FC_ASSERT( select.value < t.members.size(), "Invalid packed variant" );
+            out.put( '[' );
+            out.string( t.members[select.value].first );
+            out.put( ',' );
+            write( out, *t.members[select.value].second, ds, depth );
+            out.put( ']' );
+            return false;
+         }
+         case type::structure: {
+            FC_ASSERT( !t.members.empty(), "Unable to unpack an empty struct" );
+            out.put( '{' );
+            bool first = true;
+            for( size_t i = 0; i < t.members.size(); ++i ) {
+               if( !ds.remaining() ) {
+                  if( t.extensions[i] )
+                     continue;
+                  FC_THROW( "Stream unexpectedly ended; unable to unpack field '${f}'", ("f", t.members[i].first) );
+               }
+               if( !first )
+                  out.put( ',' );
+               first = false;
+               out.string( t.members[i].first );
+               out.put( ':' );
+               write( out, *t.members[i].second, ds, depth );
+            }
+            out.put( '}' );
+            return false;
+         }
+         default:
+            FC_THROW( "Unknown abi type" );
+      }
+   }
+
+private:
+   static constexpr size_t max_depth = 32;
+
+   struct compiler {
+      abi_json_schema&                                       schema;
+      const chain::abi_serializer&                           serializer;
+      std::map<std::string, std::string>                     typedefs;
+      std::map<std::string, const chain::struct_def*>        structs;
+      std::map<std::string, const std::vector<chain::type_name>*> variants;
+      std::map<std::string, type*>                           compiled;
+
+      std::string resolve( const std::string& t ) const {
+         auto itr = typedefs.find( t );
+         if( itr != typedefs.end() ) {
+            for( auto i = typedefs.size(); i > 0; --i ) { // avoid infinite recursion
+               const std::string& next = itr->second;
+               itr = typedefs.find( next );
+               if( itr == typedefs.end() )
+                  return next;
+            }
+         }
+         return t;
+      }
+      static bool is_array( const std::string& t ) { return t.size() > 2 && t.compare( t.size() - 2, 2, "[]" ) == 0; }
+      static bool is_optional( const std::string& t ) { return t.size() > 1 && t.back() == '?'; }
+      static std::string fundamental( const std::string& t ) {
+         if( is_array( t )) return t.substr( 0, t.size() - 2 );
+         if( is_optional( t )) return t.substr( 0, t.size() - 1 );
+         return t;
+      }
+
+      type& make( const std::string& key ) {
+         schema.types.emplace_back();
+         auto* t = &schema.types.back();
+         compiled[key] = t;
+         return *t;
+      }
+
+      const type* builtin( const std::string& name ) {
+         const std::string key = "builtin:" + name;
+         auto itr = compiled.find( key );
+         if( itr != compiled.end() )
+            return itr->second;
+         static const std::map<std::string, type::builtin_t> fast = {
+            { "int8", type::int8 }, { "uint8", type::uint8 }, { "int16", type::int16 }, { "uint16", type::uint16 },
+            { "int32", type::int32 }, { "uint32", type::uint32 }, { "int64", type::int64 }, { "uint64", type::uint64 },
+            { "varint32", type::varint32 }, { "varuint32", type::varuint32 }, { "name", type::name },
+            { "string", type::string }, { "bytes", type::bytes }, { "checksum160", type::checksum160 },
+            { "checksum256", type::checksum256 }, { "checksum512", type::checksum512 }, { "symbol", type::symbol },
+            { "asset", type::asset }, { "time_point", type::time_point }, { "time_point_sec", type::time_point_sec },
+            { "block_timestamp_type", type::block_timestamp } };
+         auto& t = make( key );
+         t.kind = type::builtin;
+         auto f = fast.find( name );
+         t.builtin_type = f == fast.end() ? type::other : f->second;
+         return &t;
+      }
+
+      const type* compile( const std::string& name ) {
+         auto itr = compiled.find( name );
+         if( itr != compiled.end() )
+            return itr->second;
+         auto& t = make( name ); // registered first so recursive types end up as cycles
+         const std::string rtype = resolve( name );
+         const std::string ftype = fundamental( rtype );
+         if( serializer.is_builtin_type( ftype )) {
+            if( is_array( rtype ) || is_optional( rtype )) {
+               t.kind = is_array( rtype ) ? type::array : type::optional;
+               t.element = builtin( ftype );
+            } else {
+               t = *builtin( ftype );
+            }
+         } else if( is_array( rtype )) {
+            t.kind = type::array;
+            t.element = compile( ftype );
+         } else if( is_optional( rtype )) {
+            t.kind = type::optional;
+            t.element = compile( ftype );
+         } else if( variants.count( rtype )) {
+            t.kind = type::variant;
+            for( const auto& alternative : *variants[rtype] )
+               t.members.emplace_back( alternative, compile( alternative ));
+         } else if( structs.count( rtype )) {
+            t.kind = type::structure;
+            std::set<std::string> names;
+            if( !add_fields( t, rtype, names, 0 ))
+               t.kind = type::failure; // abi_serializer fails on reaching it, so do we
+         }
+         return &t;
+      }
+
+      bool add_fields( type& t, const std::string& struct_name, std::set<std::string>& names, size_t depth ) {
+         auto itr = structs.find( struct_name );
+         if( itr == structs.end() || depth >= max_depth )
+            return false;
+         const auto& st = *itr->second;
+         if( !st.base.empty() && !add_fields( t, resolve( st.base ), names, depth + 1 ))
+            return false;
+         for( const auto& field : st.fields ) {
+            // a repeated name replaces the earlier value in place in the variant form
+            if( !names.insert( field.name ).second )
+               t.duplicate_fields = true;
+            const bool extension = !field.type.empty() && field.type.back() == '$';
+            const std::string field_type = extension ? field.type.substr( 0, field.type.size() - 1 ) : std::string( field.type );
+            t.members.emplace_back( field.name, compile( resolve( field_type )));
+            t.extensions.push_back( extension );
+         }
+         return true;
+      }
+   };
+
+   static bool streamable( const type& t, std::set<const type*>& seen ) {
+      if( !seen.insert( &t ).second )
+         return true;
+      if( t.kind == type::failure || (t.kind == type::builtin && t.builtin_type == type::other) || t.duplicate_fields )
+         return false;
+      if( t.element && !streamable( *t.element, seen ))
+         return false;
+      for( const auto& m : t.members ) {
+         if( !streamable( *m.second, seen ))
+            return false;
+      }
+      return true;
+   }
+
+   template<typename T>
+   static T read( fc::datastream<const char*>& ds ) {
+      T v;
+      fc::raw::unpack( ds, v );
+      return v;
+   }
+
+   static void write_bytes( json_buffer& out, fc::datastream<const char*>& ds, bool hex ) {
+      const auto size = read<fc::unsigned_int>( ds ).value;
+      FC_ASSERT( ds.remaining() >= size, "read datastream over by ${v}", ("v", size - ds.remaining()) );
+      if( hex )
+         out.hex_string( ds.pos(), size );
+      else
+         out.string( ds.pos(), size );
+      ds.skip( size );
+   }
+
+   static void write_fixed_hex( json_buffer& out, fc::datastream<const char*>& ds, size_t size ) {
+      FC_ASSERT( ds.remaining() >= size, "read datastream over by ${v}", ("v", size - ds.remaining()) );
+      out.hex_string( ds.pos(), size );
+      ds.skip( size );
+   }
+
+   static void write_builtin( json_buffer& out, type::builtin_t b, fc::datastream<const char*>& ds ) {
+      switch( b ) {
+         case type::int8:            out.sint( read<int8_t>( ds )); break;
+         case type::uint8:           out.uint( read<uint8_t>( ds )); break;
+         case type::int16:           out.sint( read<int16_t>( ds )); break;
+         case type::uint16:          out.uint( read<uint16_t>( ds )); break;
+         case type::int32:           out.sint( read<int32_t>( ds )); break;
+         case type::uint32:          out.uint( read<uint32_t>( ds )); break;
+         case type::int64:           out.int64( read<int64_t>( ds )); break;
+         case type::uint64:          out.uint64( read<uint64_t>( ds )); break;
+         case type::varint32:        out.sint( read<fc::signed_int>( ds ).value ); break;
+         case type::varuint32:       out.uint( read<fc::unsigned_int>( ds ).value ); break;
+         case type::name:            out.name( read<uint64_t>( ds )); break;
+         case type::string:          write_bytes( out, ds, false ); break;
+         case type::bytes:           write_bytes( out, ds, true ); break;
+         case type::checksum160:     write_fixed_hex( out, ds, 20 ); break;
+         case type::checksum256:     write_fixed_hex( out, ds, 32 ); break;
+         case type::checksum512:     write_fixed_hex( out, ds, 64 ); break;
+         case type::symbol:          out.string( read<chain::symbol>( ds ).to_string() ); break;
+         case type::asset:           out.string( read<chain::asset>( ds ).to_string() ); break;
+         case type::time_point:      out.string( std::string( read<fc::time_point>( ds ))); break;
+         case type::time_point_sec:  out.string( std::string( read<fc::time_point_sec>( ds ))); break;
+         case type::block_timestamp: out.string( std::string( fc::time_point( read<chain::block_timestamp_type>( ds )))); break;
+         default:                    FC_THROW( "Type not streamable" );
+      }
+   }
+
+   std::deque<type>                                  types; ///< stable addresses for the graph
+   std::unordered_map<uint64_t, action_type>         actions;
+};
+
+/**
+ * Writes trx as fc::json::to_string( abi_serializer::to_variant( trx, resolver, max_time )) prints it,
+ * without the variant tree. Action data is written straight from its packed bytes when the abi
+ * allows, otherwise that one action goes through binary_to_variant. resolver returns an
+ * abi_serializer_ref.
+ */
+template<typename Resolver>
+void write_transaction_json( json_buffer& out, const chain::transaction& trx, Resolver&& resolver, const fc::microseconds& max_time ) {
+   const auto deadline = fc::time_point::now() + max_time;
+   auto write_actions = [&]( const std::vector<chain::action>& actions ) {
+      out.put( '[' );
+      for( size_t i = 0; i < actions.size(); ++i ) {
+         const auto& act = actions[i];
+         if( i > 0 )
+            out.put( ',' );
+         out.put( "{\"account\":" );
+         out.name( act.account.value );
+         out.put( ",\"name\":" );
+         out.name( act.name.value );
+         out.put( ",\"authorization\":[" );
+         for( size_t a = 0; a < act.authorization.size(); ++a ) {
+            out.put( a > 0 ? ",{\"actor\":" : "{\"actor\":" );
+            out.name( act.authorization[a].actor.value );
+            out.put( ",\"permission\":" );
+            out.name( act.authorization[a].permission.value );
+            out.put( '}' );
+         }
+         out.put( ']' );
+
+         // decoded data and its hex, or only the hex when the abi can not decode it
+         const size_t mark = out.size();
+         bool decoded = false;
+         try {
+            auto abi = resolver( act.account );
+            if( abi.valid() ) {
+               const auto* action_type = abi.json ? abi.json->find_action( act.name ) : nullptr;
+               const std::string type = abi.json ? (action_type ? action_type->type_name : std::string()) : std::string( abi->get_action_type( act.name ));
+               if( !type.empty() ) {
+                  try {
+                     FC_ASSERT( fc::time_point::now() < deadline, "serialization time limit ${t}us exceeded", ("t", max_time) );
+                     out.put( ",\"data\":" );
+                     if( action_type && action_type->streamable ) {
+                        fc::datastream<const char*> ds( act.data.data(), act.data.size() );
+                        abi.json->write( out, *action_type->root, ds );
+                     } else {
+                        out.put( fc::json::to_string( abi->binary_to_variant( type, act.data, max_time )));
+                     }
+                     out.put( ",\"hex_data\":" );
+                     out.hex_string( act.data );
+                     decoded = true;
+                  } catch( ... ) {
+                     out.truncate( mark );
+                  }
+               }
+            }
+         } catch( ... ) {
+            out.truncate( mark );
+         }
+         if( !decoded ) {
+            out.put( ",\"data\":" );
+            out.hex_string( act.data );
+         }
+         out.put( '}' );
+      }
+      out.put( ']' );
+   };
+
+   out.put( "{\"expiration\":" );
+   out.string( std::string( trx.expiration ));
+   out.put( ",\"ref_block_num\":" );
+   out.uint( trx.ref_block_num );
+   out.put( ",\"ref_block_prefix\":" );
+   out.uint( trx.ref_block_prefix );
+   out.put( ",\"max_net_usage_words\":" );
+   out.uint( trx.max_net_usage_words.value );
+   out.put( ",\"max_cpu_usage_ms\":" );
+   out.uint( trx.max_cpu_usage_ms );
+   out.put( ",\"delay_sec\":" );
+   out.uint( trx.delay_sec.value );
+   out.put( ",\"context_free_actions\":" );
+   write_actions( trx.context_free_actions );
+   out.put( ",\"actions\":" );
+   write_actions( trx.actions );
+   out.put( ",\"transaction_extensions\":[" );
+   for( size_t i = 0; i < trx.transaction_extensions.size(); ++i ) {
+      const auto& ext = trx.transaction_extensions[i];
+      out.put( i > 0 ? ",[" : "[" );
+      out.uint( ext.first );
+      out.put( ',' );
+      out.hex_string( ext.second );
+      out.put( ']' );
+   }
+   out.put( "]}" );
+}
+
+}
@@ -0,0 +1,110 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <eosio/chain/block_state.hpp>
+#include <eosio/chain/trace.hpp>
+#include <eosio/chain/transaction_metadata.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+namespace eosio {
+
+/// what happens to an entry that does not fit the memory budget
+enum class memory_overflow_policy {
+   shed,      ///< drop accepted transactions, traces and accepted blocks
+   downgrade, ///< as shed, but keep accepted blocks as their header only
+   spill      ///< as downgrade, and keep irreversible blocks as their number, read back from blocks.log
+};
+
+/**
+ * Byte budget over chain objects queued for the consume thread and export messages in flight.
+ * Queued entries are charged with an estimate of what they keep alive when admitted and
+ * released with the same estimate once processed. In-flight bytes are sampled by the consume
+ * thread, so admission can overshoot by what was built since the last sample.
+ */
+class memory_budget {
+public:
+   void set_limit( uint64_t bytes ) { max_bytes = bytes; }
+   uint64_t limit() const { return max_bytes; }
+
+   /// charges bytes if they fit the budget or there is none
+   bool try_charge( uint64_t bytes ) {
+      if( max_bytes > 0 && used() + bytes > max_bytes )
+         return false;
+      charge( bytes );
+      return true;
+   }
+   void charge( uint64_t bytes ) { queued_bytes.fetch_add( bytes, std::memory_order_relaxed ); }
+   void release( uint64_t bytes ) { queued_bytes.fetch_sub( bytes, std::memory_order_relaxed ); }
+   void set_in_flight( uint64_t bytes ) { in_flight_bytes.store( bytes, std::memory_order_relaxed ); }
+
+   bool over() const { return max_bytes > 0 && used() >= max_bytes; }
+   uint64_t used() const { return queued() + in_flight(); }
+   uint64_t queued() const { return queued_bytes.load( std::memory_order_relaxed ); }
+   uint64_t in_flight() const { return in_flight_bytes.load( std::memory_order_relaxed ); }
+
+private:
+   uint64_t               max_bytes = 0; ///< 0 for accounting only
+   std::atomic<uint64_t>  queued_bytes{0};
+   std::atomic<uint64_t>  in_flight_bytes{0};
+};
+
+/// estimates of the heap memory a queued chain object keeps alive, cheap enough for every signal
+inline uint64_t approx_size( const chain::packed_transaction& pt ) {
+   return sizeof( pt ) + pt.packed_trx.size() + pt.packed_context_free_data.size() +
+          pt.signatures.size() * sizeof( chain::signature_type );
+}
+
+inline uint64_t approx_size( const chain::signed_block& block ) {
+   uint64_t size = sizeof( block );
+   for( const auto& receipt : block.transactions ) {
+      size += sizeof( receipt );
+      if( receipt.trx.contains<chain::packed_transaction>() )
+         size += approx_size( receipt.trx.get<chain::packed_transaction>() );
+   }
+   return size;
+}
+
+inline uint64_t approx_size( const chain::signed_transaction& trx ) {
+   uint64_t size = sizeof( trx ) + trx.signatures.size() * sizeof( chain::signature_type );
+   for( const auto& act : trx.context_free_actions )
+      size += sizeof( act ) + act.data.size();
+   for( const auto& act : trx.actions )
+      size += sizeof( act ) + act.data.size() + act.authorization.size() * sizeof( chain::permission_level );
+   for( const auto& data : trx.context_free_data )
+      size += sizeof( data ) + data.size();
+   return size;
+}
+
+/// metadata keeps the transaction both unpacked and packed, counted as twice the unpacked one
+inline uint64_t approx_size( const chain::transaction_metadata& meta ) {
+   return sizeof( meta ) + 2 * approx_size( meta.trx );
+}
+
+inline uint64_t approx_size( const chain::block_state& bs ) {
+   uint64_t size = sizeof( bs ) + (bs.block ? approx_size( *bs.block ) : 0);
+   for( const auto& meta : bs.trxs )
+      size += meta ? approx_size( *meta ) : 0;
+   return size;
+}
+
+inline uint64_t approx_size( const chain::action_trace& atrace ) {
+   uint64_t size = sizeof( atrace ) + atrace.act.data.size() + atrace.console.size() +
+                   atrace.act.authorization.size() * sizeof( chain::permission_level );
+   for( const auto& inline_trace : atrace.inline_traces )
+      size += approx_size( inline_trace );
+   return size;
+}
+
+inline uint64_t approx_size( const chain::transaction_trace& trace ) {
+   uint64_t size = sizeof( trace );
+   for( const auto& atrace : trace.action_traces )
+      size += approx_size( atrace );
+   return size;
+}
+
+}
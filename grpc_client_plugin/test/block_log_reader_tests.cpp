@@ -0,0 +1,229 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/grpc_client_plugin/block_log_reader.hpp>
+#include <eosio/grpc_client_plugin/export_cursor.hpp>
+
+#include <fc/filesystem.hpp>
+#include <fc/io/raw.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace eosio;
+using chain::signed_block;
+using chain::signed_block_ptr;
+
+namespace {
+
+/// blocks.log and blocks.index in the layout chain::block_log writes, version 2 starting at block 1
+class test_block_log {
+public:
+   test_block_log() {
+      std::ofstream log( log_path().generic_string(), std::ios::binary );
+      const uint32_t version = 2;
+      const uint32_t first = 1;
+      log.write( reinterpret_cast<const char*>( &version ), sizeof( version ));
+      log.write( reinterpret_cast<const char*>( &first ), sizeof( first ));
+      std::ofstream index( index_path().generic_string(), std::ios::binary );
+   }
+
+   fc::path dir() const { return tmp.path(); }
+
+   /// appends the next block, with its index entry unless indexed is false, and returns it
+   signed_block_ptr append( bool indexed = true, int64_t position_error = 0 ) {
+      auto block = std::make_shared<signed_block>();
+      if( !blocks.empty() )
+         block->previous = blocks.back()->id();
+      block->producer = N(eosio);
+      // a few receipts so the blocks differ in size
+      for( uint32_t i = 0; i <= blocks.size() % 3; ++i )
+         block->transactions.emplace_back( chain::transaction_id_type::hash( std::to_string( blocks.size() * 10 + i )));
+
+      const uint64_t position = fc::file_size( log_path() );
+      std::ofstream log( log_path().generic_string(), std::ios::binary | std::ios::app );
+      const auto packed = fc::raw::pack( *block );
+      log.write( packed.data(), packed.size() );
+      const uint64_t trailer = position + position_error;
+      log.write( reinterpret_cast<const char*>( &trailer ), sizeof( trailer ));
+      if( indexed ) {
+         std::ofstream index( index_path().generic_string(), std::ios::binary | std::ios::app );
+         index.write( reinterpret_cast<const char*>( &position ), sizeof( position ));
+      }
+      blocks.push_back( block );
+      return block;
+   }
+
+   fc::path log_path() const { return dir() / "blocks.log"; }
+   fc::path index_path() const { return dir() / "blocks.index"; }
+
+   std::vector<signed_block_ptr> blocks;
+
+private:
+   fc::temp_directory tmp;
+};
+
+std::vector<signed_block_ptr> unpack_all( const std::vector<char>& buffer, const std::vector<uint64_t>& offsets, uint32_t from ) {
+   std::vector<signed_block_ptr> result;
+   for( size_t i = 0; i + 1 < offsets.size(); ++i )
+      result.push_back( block_log_reader::unpack( buffer.data() + offsets[i], offsets[i + 1] - offsets[i], from + i ));
+   return result;
+}
+
+struct live_entry {
+   uint32_t block_num = 0;
+};
+
+}
+
+BOOST_AUTO_TEST_SUITE(block_log_reader_tests)
+
+BOOST_AUTO_TEST_CASE(reads_indexed_blocks) {
+   test_block_log log;
+   for( int i = 0; i < 5; ++i )
+      log.append();
+
+   block_log_reader reader;
+   reader.open( log.dir() );
+   BOOST_CHECK_EQUAL( reader.first_block_num(), 1u );
+   BOOST_CHECK_EQUAL( reader.last_block_num(), 5u );
+
+   std::vector<char> buffer;
+   std::vector<uint64_t> offsets;
+   reader.read( 2, 4, buffer, offsets );
+   const auto blocks = unpack_all( buffer, offsets, 2 );
+   BOOST_REQUIRE_EQUAL( blocks.size(), 3u );
+   for( size_t i = 0; i < blocks.size(); ++i )
+      BOOST_CHECK( blocks[i]->id() == log.blocks[i + 1]->id() );
+   BOOST_CHECK_EQUAL( offsets.back(), buffer.size() );
+}
+
+BOOST_AUTO_TEST_CASE(tail_stops_at_last_indexed_block) {
+   test_block_log log;
+   for( int i = 0; i < 5; ++i )
+      log.append();
+   // the controller writes the log entry before the index entry, a reader can see it in between
+   log.append( false );
+
+   block_log_reader reader;
+   reader.open( log.dir() );
+   BOOST_CHECK_EQUAL( reader.last_block_num(), 5u );
+
+   std::vector<char> buffer;
+   std::vector<uint64_t> offsets;
+   reader.read( 3, 5, buffer, offsets );
+   const auto blocks = unpack_all( buffer, offsets, 3 );
+   BOOST_REQUIRE_EQUAL( blocks.size(), 3u );
+   BOOST_CHECK( blocks.back()->id() == log.blocks[4]->id() );
+   // the entry of block 5 ends with its position, block 6 is not part of the read
+   const uint64_t block5_size = fc::raw::pack_size( *log.blocks[4] ) + sizeof( uint64_t );
+   BOOST_CHECK_EQUAL( offsets.back() - offsets[offsets.size() - 2], block5_size );
+   BOOST_CHECK_EQUAL( offsets.back(), buffer.size() );
+
+   BOOST_CHECK( reader.read_block( 5, std::chrono::milliseconds( 0 ))->id() == log.blocks[4]->id() );
+}
+
+BOOST_AUTO_TEST_CASE(tail_rejects_a_wrong_trailing_position) {
+   test_block_log log;
+   log.append();
+   log.append( true, 1 );
+
+   block_log_reader reader;
+   reader.open( log.dir() );
+   std::vector<char> buffer;
+   std::vector<uint64_t> offsets;
+   BOOST_CHECK_THROW( reader.read( 1, 2, buffer, offsets ), fc::exception );
+   reader.read( 1, 1, buffer, offsets );
+}
+
+BOOST_AUTO_TEST_CASE(backfill_hands_over_to_held_live_blocks) {
+   test_block_log log;
+   for( int i = 0; i < 8; ++i )
+      log.append();
+
+   block_log_reader reader;
+   reader.open( log.dir() );
+   std::vector<uint32_t> exported;
+   export_cursor cursor;
+   backfill_handoff<live_entry> handoff;
+   // released the way export_irreversible_entry exports a live block
+   auto release = [&]( const live_entry& e ) {
+      if( cursor.advance( e.block_num, [&]( uint32_t num ) {
+            exported.push_back( reader.read_block( num, std::chrono::milliseconds( 0 ))->block_num() );
+         } ))
+         exported.push_back( e.block_num );
+   };
+
+   // the live stream starts at block 3 while the backfill is at block 1
+   uint32_t next_backfill_block = 1;
+   for( uint32_t live : { 3, 4, 5, 6 } )
+      handoff.hold( live_entry{ live } );
+   BOOST_CHECK( !handoff.try_release( next_backfill_block, cursor, release ));
+
+   std::vector<char> buffer;
+   std::vector<uint64_t> offsets;
+   reader.read( 1, 2, buffer, offsets );
+   for( const auto& block : unpack_all( buffer, offsets, 1 ))
+      exported.push_back( block->block_num() );
+   next_backfill_block = 3;
+   // the backfill reads a whole chunk past the first held block, the handoff skips what it exported
+   reader.read( 3, 4, buffer, offsets );
+   for( const auto& block : unpack_all( buffer, offsets, 3 ))
+      exported.push_back( block->block_num() );
+   next_backfill_block = 5;
+   BOOST_CHECK( handoff.try_release( next_backfill_block, cursor, release ));
+   BOOST_CHECK( handoff.empty() );
+   for( uint32_t live : { 7, 8 } )
+      release( live_entry{ live } );
+
+   const std::vector<uint32_t> expected = { 1, 2, 3, 4, 5, 6, 7, 8 };
+   BOOST_CHECK_EQUAL_COLLECTIONS( exported.begin(), exported.end(), expected.begin(), expected.end() );
+   BOOST_CHECK_EQUAL( cursor.next_block(), 9u );
+}
+
+BOOST_AUTO_TEST_CASE(spool_gap_is_filled_from_the_log) {
+   test_block_log log;
+   for( int i = 0; i < 8; ++i )
+      log.append();
+
+   block_log_reader reader;
+   reader.open( log.dir() );
+   std::vector<uint32_t> exported;
+
+   // the spool holds blocks up to 3, the live stream continues at block 7
+   export_cursor cursor;
+   cursor.start( 4 );
+   for( uint32_t live : { 7, 8 } ) {
+      if( cursor.advance( live, [&]( uint32_t num ) {
+            exported.push_back( reader.read_block( num, std::chrono::milliseconds( 0 ))->block_num() );
+         } ))
+         exported.push_back( live );
+   }
+
+   const std::vector<uint32_t> expected = { 4, 5, 6, 7, 8 };
+   BOOST_CHECK_EQUAL_COLLECTIONS( exported.begin(), exported.end(), expected.begin(), expected.end() );
+   BOOST_CHECK_EQUAL( cursor.next_block(), 9u );
+}
+
+BOOST_AUTO_TEST_CASE(cursor_stays_at_a_block_it_could_not_fill) {
+   test_block_log log;
+   for( int i = 0; i < 4; ++i )
+      log.append();
+
+   block_log_reader reader;
+   reader.open( log.dir() );
+   export_cursor cursor;
+   BOOST_CHECK( cursor.advance( 1, []( uint32_t ) { BOOST_FAIL( "nothing to fill before start" ); } ));
+
+   cursor.start( 3 );
+   // blocks 5 and 6 are not in the log
+   BOOST_CHECK_THROW( cursor.advance( 7, [&]( uint32_t num ) { reader.read_block( num, std::chrono::milliseconds( 0 )); } ),
+                      fc::exception );
+   BOOST_CHECK_EQUAL( cursor.next_block(), 5u );
+}
+
+BOOST_AUTO_TEST_SUITE_END()
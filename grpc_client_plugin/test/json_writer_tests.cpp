@@ -0,0 +1,203 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#include <eosio/grpc_client_plugin/abi_cache.hpp>
+#include <eosio/grpc_client_plugin/json_writer.hpp>
+#include <eosio/chain/abi_serializer.hpp>
+#include <eosio/chain/transaction.hpp>
+
+#include <fc/io/json.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/variant_object.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <cstring>
+#include <limits>
+#include <string>
+
+using namespace eosio;
+using namespace eosio::chain;
+
+namespace {
+
+const fc::microseconds max_serialization_time = fc::seconds( 10 );
+
+/// nested structs with a base, arrays, optionals, a variant and every type the writer streams
+abi_def types_abi() {
+   abi_def abi;
+   abi.version = "eosio::abi/1.1";
+   abi.types.emplace_back( type_def{ "account", "name" } );
+   abi.structs.emplace_back( struct_def{ "numbers", "", {
+      { "i8", "int8" }, { "u8", "uint8" }, { "i16", "int16" }, { "u16", "uint16" }, { "i32", "int32" }, { "u32", "uint32" },
+      { "small_i64", "int64" }, { "big_i64", "int64" }, { "negative_i64", "int64" },
+      { "small_u64", "uint64" }, { "big_u64", "uint64" }, { "vi", "varint32" }, { "vu", "varuint32" } } } );
+   abi.structs.emplace_back( struct_def{ "header", "", { { "owner", "account" }, { "sequence", "uint64" } } } );
+   abi.structs.emplace_back( struct_def{ "record", "header", {
+      { "numbers", "numbers" }, { "sym", "symbol" }, { "quantity", "asset" }, { "note", "string" }, { "blob", "bytes" },
+      { "digest", "checksum256" }, { "when", "time_point_sec" }, { "at", "time_point" }, { "slot", "block_timestamp_type" },
+      { "tags", "name[]" }, { "maybe", "uint32?" }, { "nothing", "uint32?" }, { "children", "header[]" },
+      { "choice", "number_or_text" } } } );
+   abi.variants.value.emplace_back( variant_def{ "number_or_text", { "uint32", "string" } } );
+   abi.structs.emplace_back( struct_def{ "wide", "", { { "big", "uint128" }, { "on", "bool" } } } );
+   abi.structs.emplace_back( struct_def{ "ext", "", { { "id", "uint64" }, { "extra", "uint32$" } } } );
+   abi.actions.emplace_back( action_def{ N(record), "record", "" } );
+   abi.actions.emplace_back( action_def{ N(wide), "wide", "" } );
+   abi.actions.emplace_back( action_def{ N(ext), "ext", "" } );
+   return abi;
+}
+
+struct test_resolver {
+   abi_cache cache{ 16, 1, max_serialization_time };
+
+   test_resolver() {
+      cache.set( N(test.types), fc::raw::pack( types_abi() ));
+      cache.set( N(test.noabi), bytes() );
+   }
+
+   abi_serializer_ref operator()( account_name n ) {
+      abi_serializer_ref ref;
+      cache.lookup( n, ref );
+      return ref;
+   }
+};
+
+action make_action( account_name account, action_name name, bytes data ) {
+   action act;
+   act.account = account;
+   act.name = name;
+   act.authorization = { permission_level{ N(alice), N(active) }, permission_level{ N(bob), N(owner) } };
+   act.data = std::move( data );
+   return act;
+}
+
+bytes record_data() {
+   abi_serializer serializer( types_abi(), max_serialization_time );
+   const auto v = fc::json::from_string( R"({
+      "owner": "alice", "sequence": "18446744073709551615",
+      "numbers": {
+         "i8": -128, "u8": 255, "i16": -32768, "u16": 65535, "i32": -2147483648, "u32": 4294967295,
+         "small_i64": -4294967295, "big_i64": "9223372036854775807", "negative_i64": "-9223372036854775808",
+         "small_u64": 4294967295, "big_u64": "4294967296", "vi": -5, "vu": 300 },
+      "sym": "4,EOS", "quantity": "-1.2345 EOS",
+      "blob": "00ff7f80",
+      "digest": "c0fd0a8a7b2cd0dd0a1c5bd9b3a5a3e0c0fd0a8a7b2cd0dd0a1c5bd9b3a5a3e0",
+      "when": "2018-06-01T12:00:00", "at": "2018-06-01T12:00:00.500", "slot": "2018-06-01T12:00:00.000",
+      "tags": ["eosio.token", "a", "zzzzzzzzzzzzj"], "maybe": 7, "nothing": null,
+      "children": [ { "owner": "bob", "sequence": 1 }, { "owner": "carol", "sequence": "4294967296" } ],
+      "choice": ["string", "picked"] })" );
+   // escapes spread over and across the eight byte words the writer scans
+   fc::mutable_variant_object record( v.get_object() );
+   record( "note", std::string( "quote \" backslash \\ newline \n tab \t bell \a nul " ) + '\0' +
+                   " unicode \xc3\xa9 and a tail long enough for the word scan" );
+   return serializer.variant_to_binary( "record", fc::variant( record ), max_serialization_time );
+}
+
+/// uint128 and bool are written through the variant path, packed by hand so no variant form is needed to build them
+bytes wide_data() {
+   bytes data( 17 );
+   const uint64_t low = 0xffffffffffffffffull, high = 0x0102030405060708ull;
+   memcpy( data.data(), &low, sizeof( low ));
+   memcpy( data.data() + 8, &high, sizeof( high ));
+   data[16] = 1;
+   return data;
+}
+
+bytes ext_data( bool with_extension ) {
+   bytes data = fc::raw::pack( uint64_t( 5000000000ull ));
+   if( with_extension ) {
+      const auto extra = fc::raw::pack( uint32_t( 42 ));
+      data.insert( data.end(), extra.begin(), extra.end() );
+   }
+   return data;
+}
+
+transaction make_transaction() {
+   transaction trx;
+   trx.expiration = fc::time_point_sec( 1527854400 );
+   trx.ref_block_num = 65535;
+   trx.ref_block_prefix = 4294967295u;
+   trx.max_net_usage_words = 100;
+   trx.max_cpu_usage_ms = 255;
+   trx.delay_sec = 3;
+   trx.context_free_actions.emplace_back( make_action( N(test.noabi), N(cfa), bytes{ 'a', 'b' } ));
+   trx.context_free_actions.back().authorization.clear();
+   trx.actions.emplace_back( make_action( N(test.types), N(record), record_data() ));
+   trx.actions.emplace_back( make_action( N(test.types), N(wide), wide_data() ));
+   trx.actions.emplace_back( make_action( N(test.types), N(ext), ext_data( true )));
+   trx.actions.emplace_back( make_action( N(test.types), N(ext), ext_data( false )));
+   // no abi, unknown action, undecodable data and an account without a cache entry
+   trx.actions.emplace_back( make_action( N(test.noabi), N(transfer), bytes{ 1, 2, 3 } ));
+   trx.actions.emplace_back( make_action( N(test.types), N(unknown), bytes{ 4 } ));
+   trx.actions.emplace_back( make_action( N(test.types), N(record), bytes{ 1 } ));
+   trx.actions.emplace_back( make_action( N(test.missing), N(record), bytes() ));
+   trx.transaction_extensions.emplace_back( 1, bytes{ 'x', '\0', '"' } );
+   return trx;
+}
+
+std::string variant_json( const transaction& trx, test_resolver& resolver ) {
+   fc::variant v;
+   abi_serializer::to_variant( trx, v, [&]( account_name n ) { return resolver( n ); }, max_serialization_time );
+   return fc::json::to_string( v );
+}
+
+std::string stream_json( const transaction& trx, test_resolver& resolver ) {
+   json_buffer out;
+   write_transaction_json( out, trx, [&]( account_name n ) { return resolver( n ); }, max_serialization_time );
+   return out.str();
+}
+
+}
+
+BOOST_AUTO_TEST_SUITE(json_writer_tests)
+
+BOOST_AUTO_TEST_CASE(stream_matches_variant) {
+   test_resolver resolver;
+   const auto trx = make_transaction();
+   BOOST_CHECK_EQUAL( stream_json( trx, resolver ), variant_json( trx, resolver ));
+}
+
+BOOST_AUTO_TEST_CASE(record_is_streamed) {
+   test_resolver resolver;
+   const auto abi = resolver( N(test.types) );
+   BOOST_REQUIRE( abi.valid() && abi.json );
+   BOOST_CHECK( abi.json->find_action( N(record) )->streamable );
+   BOOST_CHECK( abi.json->find_action( N(ext) )->streamable );
+   BOOST_CHECK( !abi.json->find_action( N(wide) )->streamable );
+   BOOST_CHECK( abi.json->find_action( N(unknown) ) == nullptr );
+}
+
+BOOST_AUTO_TEST_CASE(buffer_formats_like_fc_json) {
+   const std::string text = std::string( "plain \" \\ \b \f \n \r \t " ) + char( 0x01 ) + char( 0x1f ) + " \xc3\xa9 0123456789abcdef";
+   for( size_t len = 0; len <= text.size(); ++len ) {
+      json_buffer out;
+      out.string( text.substr( 0, len ));
+      BOOST_CHECK_EQUAL( out.str(), fc::json::to_string( fc::variant( text.substr( 0, len ))));
+   }
+
+   for( int64_t v : { int64_t( 0 ), int64_t( -1 ), int64_t( 4294967295ll ), int64_t( -4294967295ll ), int64_t( 4294967296ll ),
+                      int64_t( -4294967296ll ), std::numeric_limits<int64_t>::max(), std::numeric_limits<int64_t>::min() } ) {
+      json_buffer out;
+      out.int64( v );
+      BOOST_CHECK_EQUAL( out.str(), fc::json::to_string( fc::variant( v )));
+   }
+   for( uint64_t v : { uint64_t( 0 ), uint64_t( 4294967295ull ), uint64_t( 4294967296ull ), std::numeric_limits<uint64_t>::max() } ) {
+      json_buffer out;
+      out.uint64( v );
+      BOOST_CHECK_EQUAL( out.str(), fc::json::to_string( fc::variant( v )));
+   }
+
+   for( const char* n : { "", "a", "eosio.token", "zzzzzzzzzzzzj", "1.2.3.4.5" } ) {
+      json_buffer out;
+      out.name( name( n ).value );
+      BOOST_CHECK_EQUAL( out.str(), fc::json::to_string( fc::variant( name( n ))));
+   }
+
+   const bytes blob = { '\0', '\x7f', '\x80', '\xff' };
+   json_buffer out;
+   out.hex_string( blob );
+   BOOST_CHECK_EQUAL( out.str(), fc::json::to_string( fc::variant( blob )));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,6 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#define BOOST_TEST_MODULE grpc_client_plugin
+#include <boost/test/unit_test.hpp>
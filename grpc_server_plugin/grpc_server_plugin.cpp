@@ -3,6 +3,10 @@
  *  @copyright defined in eos/LICENSE.txt
  */
 #include <eosio/grpc_server_plugin/grpc_server_plugin.hpp>
+#include <eosio/grpc_server_plugin/async_call.hpp>
+#include <eosio/grpc_client_plugin/grpc_client_plugin.hpp>
+#include <eosio/grpc_client_plugin/block_log_reader.hpp>
+#include <eosio/chain/plugin_interface.hpp>
 #include <eosio/chain/eosio_contract.hpp>
 #include <eosio/chain/config.hpp>
 #include <eosio/chain/exceptions.hpp>
@@ -12,17 +16,28 @@
 #include <fc/io/json.hpp>
 #include <fc/utf8.hpp>
 #include <fc/variant.hpp>
+#include <fc/variant_object.hpp>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include <boost/chrono.hpp>
 #include <boost/signals2/connection.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition_variable.hpp>
 
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <mutex>
 #include <queue>
+#include <unordered_map>
+#include <thread>
+#include <pthread.h>
 #include <eosio/chain/genesis_state.hpp>
 #include <grpcpp/grpcpp.h>
+#include <grpcpp/generic/async_generic_service.h>
 #include "eosio_grpc_server.grpc.pb.h"
 
 namespace fc { class variant; }
@@ -42,49 +57,1302 @@ using chain::packed_transaction;
 using grpc::Server;
 using grpc::ServerBuilder;
 using grpc::ServerContext;
+using grpc::ServerCompletionQueue;
 using grpc::Status;
 using eosio_grpc_server::EosRequest;
 using eosio_grpc_server::EosReply;
 using eosio_grpc_server::Eos_Service;
+using eosio_grpc_server::Stats_Service;
+using eosio_grpc_server::StatsRequest;
+using eosio_grpc_server::StatsReply;
+using eosio_grpc_server::Transaction_Service;
+using eosio_grpc_server::PushTransactionRequest;
+using eosio_grpc_server::PushTransactionResult;
+using eosio_grpc_server::Query_Service;
+using eosio_grpc_server::TableRowsRequest;
+using eosio_grpc_server::AccountRequest;
+using eosio_grpc_server::CurrencyBalanceRequest;
+using eosio_grpc_server::QueryReply;
+using eosio_grpc_server::SubscribeRequest;
+using eosio_grpc_server::BlockMessage;
+using chain_apis::read_only;
+using namespace chain::plugin_interface;
 
 static appbase::abstract_plugin& _grpc_server_plugin = app().register_plugin<grpc_server_plugin>();
 
 
-class grpc_server_plugin_impl final : public Eos_Service::Service {
+// serves the telemetry of grpc_client_plugin when it is enabled in the same node
+static Status get_stats(const StatsRequest* request, StatsReply* reply)
+{
+   auto* client = app().find_plugin<grpc_client_plugin>();
+   if( !client || client->get_state() != abstract_plugin::started )
+      return Status(grpc::StatusCode::UNAVAILABLE, "grpc_client_plugin is not running");
+   const auto report = client->metrics();
+   for( const auto& s : report.samples() ) {
+      auto* m = reply->add_metrics();
+      m->set_name(s.name);
+      m->set_labels(s.labels);
+      switch( s.type ) {
+         case metric_sample::kind::counter: m->set_type("counter"); break;
+         case metric_sample::kind::gauge: m->set_type("gauge"); break;
+         case metric_sample::kind::histogram: m->set_type("histogram"); break;
+      }
+      m->set_value(s.value);
+      if( s.type != metric_sample::kind::histogram )
+         continue;
+      auto* h = m->mutable_histogram();
+      size_t last = 0;
+      for( size_t i = 0; i < latency_histogram::bucket_count; ++i )
+         if( s.histogram.buckets[i] ) last = i;
+      for( size_t i = 0; i <= last; ++i ) {
+         h->add_upper_bounds(latency_histogram::upper_bound(i) * s.scale);
+         h->add_counts(s.histogram.buckets[i]);
+      }
+      h->set_count(s.histogram.count);
+      h->set_sum(s.histogram.sum * s.scale);
+      h->set_p50(s.histogram.quantile(0.5) * s.scale);
+      h->set_p99(s.histogram.quantile(0.99) * s.scale);
+   }
+   if( request->prometheus() )
+      reply->set_prometheus(report.prometheus());
+   return Status::OK;
+}
+
+/**
+ * Transactions of Transaction_Service.push_transactions. They are unpacked on a worker pool, then
+ * pushed to the chain from the application thread in batches of at most batch_size per task, so
+ * other application work interleaves. Every transaction gets
+ * exactly one result through its done callback, called on a worker or the application thread.
+ */
+class transaction_ingest : public std::enable_shared_from_this<transaction_ingest> {
+public:
+   using result_fn = std::function<void(PushTransactionResult&&)>;
+
+   transaction_ingest(uint32_t threads, uint32_t batch_size)
+   : pool(threads), batch_size(std::max<uint32_t>(batch_size, 1)),
+     incoming_transaction_async(app().get_method<incoming::methods::transaction_async>()) {}
+
+   void submit(PushTransactionRequest&& request, result_fn done) {
+      auto self = shared_from_this();
+      boost::asio::post(pool, [self, request = std::move(request), done = std::move(done)]() mutable {
+         self->check(request, std::move(done));
+      });
+   }
+
+   bool stopped() const { return is_stopped; }
+
+   /// called on the application thread, results still pending are dropped
+   void stop() {
+      is_stopped = true;
+      pool.stop();
+      pool.join();
+      ilog("grpc server push_transactions: ${r} received, ${a} accepted, ${f} failed",
+           ("r", received.load())("a", accepted.load())("f", failed.load()));
+   }
+
+private:
+   struct ready_trx {
+      chain::packed_transaction_ptr trx;
+      PushTransactionResult result;
+      result_fn done;
+   };
+
+   void check(PushTransactionRequest& request, result_fn done) {
+      if( is_stopped )
+         return;
+      ++received;
+      PushTransactionResult result;
+      result.set_seq(request.seq());
+      try {
+         auto trx = std::make_shared<packed_transaction>();
+         fc::datastream<const char*> ds(request.packed_transaction().data(), request.packed_transaction().size());
+         fc::raw::unpack(ds, *trx);
+         const auto id = trx->id();
+         result.set_id(id.data(), id.data_size());
+
+         std::lock_guard<std::mutex> lock(mtx);
+         ready.push_back(ready_trx{std::move(trx), std::move(result), std::move(done)});
+         if( !push_posted ) {
+            push_posted = true;
+            auto self = shared_from_this();
+            app().get_io_service().post([self]() { self->push_batch(); });
+         }
+         return;
+      } catch( const fc::exception& e ) {
+         result.set_error_code(e.code());
+         result.set_error(e.to_string());
+      } catch( const std::exception& e ) {
+         result.set_error(e.what());
+      } catch( ... ) {
+         result.set_error("unknown exception");
+      }
+      ++failed;
+      done(std::move(result));
+   }
+
+   void push_batch() {
+      std::vector<ready_trx> batch;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         const size_t n = std::min<size_t>(ready.size(), batch_size);
+         batch.assign(std::make_move_iterator(ready.begin()), std::make_move_iterator(ready.begin() + n));
+         ready.erase(ready.begin(), ready.begin() + n);
+         if( ready.empty() ) {
+            push_posted = false;
+         } else {
+            // the rest goes behind whatever else is queued on the application thread
+            auto self = shared_from_this();
+            app().get_io_service().post([self]() { self->push_batch(); });
+         }
+      }
+      if( is_stopped )
+         return;
+      for( auto& r : batch ) {
+         auto self = shared_from_this();
+         auto result = std::make_shared<PushTransactionResult>(std::move(r.result));
+         auto done = std::move(r.done);
+         try {
+            incoming_transaction_async(r.trx, false,
+               [self, result, done](const fc::static_variant<fc::exception_ptr, chain::transaction_trace_ptr>& outcome) {
+                  if( outcome.contains<fc::exception_ptr>() ) {
+                     const auto& e = outcome.get<fc::exception_ptr>();
+                     result->set_error_code(e->code());
+                     result->set_error(e->to_string());
+                     ++self->failed;
+                  } else {
+                     const auto& trace = outcome.get<chain::transaction_trace_ptr>();
+                     result->set_accepted(true);
+                     result->set_block_num(trace->block_num);
+                     if( trace->receipt ) {
+                        result->set_cpu_usage_us(trace->receipt->cpu_usage_us);
+                        result->set_net_usage_words(trace->receipt->net_usage_words.value);
+                     }
+                     ++self->accepted;
+                  }
+                  done(std::move(*result));
+               });
+         } catch( const fc::exception& e ) {
+            result->set_error_code(e.code());
+            result->set_error(e.to_string());
+            fail(*result, done);
+         } catch( const std::exception& e ) {
+            result->set_error(e.what());
+            fail(*result, done);
+         } catch( ... ) {
+            result->set_error("unknown exception");
+            fail(*result, done);
+         }
+      }
+   }
+
+   void fail(PushTransactionResult& result, const result_fn& done) {
+      ++failed;
+      done(std::move(result));
+   }
+
+   boost::asio::thread_pool pool;
+   const uint32_t batch_size;
+   incoming::methods::transaction_async::method_type& incoming_transaction_async;
+   std::atomic_bool is_stopped{false};
+   std::mutex mtx;
+   std::vector<ready_trx> ready;
+   bool push_posted = false;
+   std::atomic<uint64_t> received{0};
+   std::atomic<uint64_t> accepted{0};
+   std::atomic<uint64_t> failed{0};
+};
+
+/**
+ * One push_transactions stream. Requests are read one at a time and handed to the ingest, and
+ * results are written one at a time as they arrive from it. Reading pauses while max_in_flight
+ * transactions of the stream wait for their result to be written, which bounds its memory.
+ * The stream keeps itself alive while it has an operation on the completion queue.
+ */
+class push_transactions_stream final : public std::enable_shared_from_this<push_transactions_stream> {
+public:
+   push_transactions_stream(Transaction_Service::AsyncService& service, ServerCompletionQueue* cq,
+                            std::shared_ptr<transaction_ingest> ingest, uint32_t max_in_flight, std::function<void()> arm_next)
+   : service(service), cq(cq), ingest(std::move(ingest)), max_in_flight(std::max<uint32_t>(max_in_flight, 1)),
+     arm_next(std::move(arm_next)) {}
+
+   void start() {
+      std::lock_guard<std::mutex> lock(mtx);
+      self = shared_from_this();
+      requesting = true;
+      service.Requestpush_transactions(&context, &stream, cq, cq, &request_op);
+   }
+
+private:
+   using ptr = std::shared_ptr<push_transactions_stream>;
+
+   void on_request(bool ok) {
+      if( ok )
+         arm_next();
+      ptr released;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         requesting = false;
+         if( ok && !ingest->stopped() ) {
+            read();
+         } else {
+            reads_done = true;
+            finished = true;
+         }
+         released = settle();
+      }
+   }
+
+   void on_read(bool ok) {
+      ptr released;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         reading = false;
+         if( ok && !ingest->stopped() ) {
+            ++in_flight;
+            auto me = shared_from_this();
+            ingest->submit(std::move(request), [me](PushTransactionResult&& r) { me->deliver(std::move(r)); });
+            if( in_flight < max_in_flight )
+               read();
+         } else {
+            reads_done = true;
+         }
+         released = settle();
+      }
+   }
+
+   void deliver(PushTransactionResult&& result) {
+      ptr released;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         if( broken || ingest->stopped() ) {
+            --in_flight;
+         } else {
+            results.push_back(std::move(result));
+            if( !writing )
+               write_next();
+         }
+         released = settle();
+      }
+   }
+
+   void on_write(bool ok) {
+      ptr released;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         writing = false;
+         --in_flight;
+         if( !ok ) {
+            // the client is gone, results still to come are dropped
+            broken = true;
+            in_flight -= results.size();
+            results.clear();
+         } else if( !ingest->stopped() ) {
+            if( !results.empty() )
+               write_next();
+            if( !reading && !reads_done && in_flight < max_in_flight )
+               read();
+         }
+         released = settle();
+      }
+   }
+
+   void on_finish(bool ok) {
+      ptr released;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         finishing = false;
+         finished = true;
+         released = settle();
+      }
+   }
+
+   void read() {
+      reading = true;
+      stream.Read(&request, &read_op);
+   }
+
+   void write_next() {
+      writing = true;
+      current = std::move(results.front());
+      results.pop_front();
+      stream.Write(current, &write_op);
+   }
+
+   /// finishes the call once every result is written, @return self once nothing is pending on the queue
+   ptr settle() {
+      if( !finished && !finishing && reads_done && in_flight == 0 && !writing && !ingest->stopped() ) {
+         finishing = true;
+         stream.Finish(Status::OK, &finish_op);
+      }
+      const bool idle = !requesting && !reading && !writing && !finishing;
+      if( idle && (finished || ingest->stopped()) )
+         return std::move(self);
+      return ptr();
+   }
+
+   Transaction_Service::AsyncService& service;
+   ServerCompletionQueue* cq;
+   std::shared_ptr<transaction_ingest> ingest;
+   const uint32_t max_in_flight;
+   std::function<void()> arm_next;
+
+   ServerContext context;
+   grpc::ServerAsyncReaderWriter<PushTransactionResult, PushTransactionRequest> stream{&context};
+   call_op<push_transactions_stream> request_op{*this, &push_transactions_stream::on_request};
+   call_op<push_transactions_stream> read_op{*this, &push_transactions_stream::on_read};
+   call_op<push_transactions_stream> write_op{*this, &push_transactions_stream::on_write};
+   call_op<push_transactions_stream> finish_op{*this, &push_transactions_stream::on_finish};
+
+   std::mutex mtx;
+   ptr self;
+   PushTransactionRequest request;
+   PushTransactionResult current;
+   std::deque<PushTransactionResult> results;
+   uint32_t in_flight = 0; ///< read and not yet written
+   bool requesting = false;
+   bool reading = false;
+   bool writing = false;
+   bool finishing = false;
+   bool reads_done = false;
+   bool broken = false;
+   bool finished = false;
+};
+
+/// push_transactions on one completion queue, every stream posts its successor when it starts
+class push_transactions_method final : public rpc_method {
+public:
+   push_transactions_method(Transaction_Service::AsyncService& service, ServerCompletionQueue* cq,
+                            std::shared_ptr<transaction_ingest> ingest, uint32_t max_in_flight)
+   : service(service), cq(cq), ingest(std::move(ingest)), max_in_flight(max_in_flight) {}
+
+   void arm() override {
+      if( ingest->stopped() )
+         return;
+      std::make_shared<push_transactions_stream>(service, cq, ingest, max_in_flight, [this]() { arm(); })->start();
+   }
+
+private:
+   Transaction_Service::AsyncService& service;
+   ServerCompletionQueue* cq;
+   std::shared_ptr<transaction_ingest> ingest;
+   uint32_t max_in_flight;
+};
+
+/**
+ * Query_Service: read-only chain state. chainbase is only safe to read on the application
+ * thread, so only the read itself runs there; parameter conversion, json rendering and the
+ * cache run on a read pool. Rendered replies are cached per request until the next accepted
+ * block, and identical requests arriving while one is read wait for its result.
+ */
+class state_query_service : public std::enable_shared_from_this<state_query_service> {
+public:
+   using finish_fn = std::function<void(Status)>;
+
+   state_query_service(uint32_t threads, size_t max_entries)
+   : pool(threads), max_entries(max_entries) {}
+
+   /// on the application thread, before the first query
+   void connect(chain::controller& chain) {
+      head_id = chain.head_block_id();
+      head_num = chain.head_block_num();
+      std::weak_ptr<state_query_service> weak = shared_from_this();
+      accepted_block_connection = chain.accepted_block.connect([weak](const chain::block_state_ptr& bs) {
+         if( auto self = weak.lock() )
+            self->on_accepted_block(bs->id, bs->block_num);
+      });
+   }
+
+   /// on the application thread, queries in progress are never answered
+   void stop() {
+      is_stopped = true;
+      accepted_block_connection.disconnect();
+      pool.stop();
+      pool.join();
+      ilog("grpc server queries: ${h} cache hits, ${m} misses, ${s} shared reads",
+           ("h", hits.load())("m", misses.load())("s", shared.load()));
+   }
+
+   /**
+    * Answers request with the json of read( read_only api, params ), where params is built from
+    * the request by make_params. The key tells requests apart, equal keys get the same reply.
+    */
+   template<typename Params, typename MakeParams, typename Read>
+   void query(std::string key, QueryReply& reply, finish_fn finish, MakeParams make_params, Read read) {
+      auto self = shared_from_this();
+      boost::asio::post(pool, [self, key = std::move(key), &reply, finish = std::move(finish), make_params, read]() mutable {
+         if( self->is_stopped )
+            return;
+         if( self->answer_cached(key, reply) ) {
+            finish(Status::OK);
+            return;
+         }
+         Params params;
+         try {
+            params = make_params();
+         } catch( const fc::exception& e ) {
+            finish(Status(grpc::StatusCode::INVALID_ARGUMENT, e.to_string()));
+            return;
+         } catch( const std::exception& e ) {
+            finish(Status(grpc::StatusCode::INVALID_ARGUMENT, e.what()));
+            return;
+         }
+         {
+            std::lock_guard<std::mutex> lock(self->mtx);
+            auto& waiters = self->reading[key];
+            waiters.push_back(waiter{&reply, std::move(finish)});
+            if( waiters.size() > 1 ) {
+               ++self->shared;
+               return;
+            }
+         }
+         ++self->misses;
+         app().get_io_service().post([self, key, params, read]() {
+            if( self->is_stopped )
+               return;
+            auto& chain = app().get_plugin<chain_plugin>();
+            auto entry = std::make_shared<cached_reply>();
+            entry->head_id = chain.chain().head_block_id();
+            entry->head_num = chain.chain().head_block_num();
+            fc::variant result;
+            Status status;
+            try {
+               result = fc::variant(read(chain.get_read_only_api(), params));
+            } catch( const fc::exception& e ) {
+               status = Status(grpc::StatusCode::INVALID_ARGUMENT, e.to_string());
+            } catch( const std::exception& e ) {
+               status = Status(grpc::StatusCode::INTERNAL, e.what());
+            }
+            boost::asio::post(self->pool, [self, key, entry, result = std::move(result), status]() {
+               if( self->is_stopped )
+                  return;
+               if( status.ok() )
+                  entry->json = fc::json::to_string(result);
+               self->complete(key, entry, status);
+            });
+         });
+      });
+   }
+
+private:
+   struct cached_reply {
+      std::string json;
+      block_id_type head_id;
+      uint32_t head_num = 0;
+   };
+   struct waiter {
+      QueryReply* reply;
+      finish_fn finish;
+   };
+
+   static void fill(QueryReply& reply, const cached_reply& entry, bool cached) {
+      reply.set_json(entry.json);
+      reply.set_head_block_id(entry.head_id.data(), entry.head_id.data_size());
+      reply.set_head_block_num(entry.head_num);
+      reply.set_cached(cached);
+   }
+
+   bool answer_cached(const std::string& key, QueryReply& reply) {
+      std::shared_ptr<const cached_reply> entry;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         auto itr = cache.find(key);
+         if( itr == cache.end() )
+            return false;
+         entry = itr->second;
+      }
+      ++hits;
+      fill(reply, *entry, true);
+      return true;
+   }
+
+   void complete(const std::string& key, const std::shared_ptr<const cached_reply>& entry, const Status& status) {
+      std::vector<waiter> waiters;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         auto itr = reading.find(key);
+         if( itr != reading.end() ) {
+            waiters = std::move(itr->second);
+            reading.erase(itr);
+         }
+         // a reply read at an older head is still right for its waiters, but not for later requests
+         if( status.ok() && entry->head_id == head_id && cache.size() < max_entries )
+            cache[key] = entry;
+      }
+      for( auto& w : waiters ) {
+         if( status.ok() )
+            fill(*w.reply, *entry, false);
+         w.finish(status);
+      }
+   }
+
+   void on_accepted_block(const block_id_type& id, uint32_t num) {
+      std::lock_guard<std::mutex> lock(mtx);
+      head_id = id;
+      head_num = num;
+      cache.clear();
+   }
+
+   boost::asio::thread_pool pool;
+   const size_t max_entries;
+   std::atomic_bool is_stopped{false};
+   boost::signals2::scoped_connection accepted_block_connection;
+   std::mutex mtx;
+   block_id_type head_id;
+   uint32_t head_num = 0;
+   std::unordered_map<std::string, std::shared_ptr<const cached_reply>> cache;
+   std::unordered_map<std::string, std::vector<waiter>> reading; ///< by key, the requests waiting for one read
+   std::atomic<uint64_t> hits{0};
+   std::atomic<uint64_t> misses{0};
+   std::atomic<uint64_t> shared{0};
+};
+
+/// a BlockMessage serialized once, every subscriber writing it references the same slice
+struct feed_event {
+   uint64_t seq;
+   uint32_t block_num;
+   grpc::Slice slice;
+};
+using feed_event_ptr = std::shared_ptr<const feed_event>;
+
+static feed_event_ptr make_feed_event(uint64_t seq, const BlockMessage& msg)
+{
+   auto* bytes = new std::string();
+   msg.SerializeToString(bytes);
+   return std::make_shared<feed_event>(feed_event{seq, msg.block_num(),
+      grpc::Slice(&(*bytes)[0], bytes->size(), [](void* p) { delete static_cast<std::string*>(p); }, bytes)});
+}
+
+static BlockMessage make_block_message(const chain::signed_block_header& header, const char* packed, size_t size, uint32_t irreversible)
+{
+   BlockMessage msg;
+   const auto id = header.id();
+   msg.set_block_num(header.block_num());
+   msg.set_block_id(id.data(), id.data_size());
+   msg.set_previous(header.previous.data(), header.previous.data_size());
+   msg.set_packed_block(packed, size);
+   msg.set_irreversible_block_num(irreversible);
+   return msg;
+}
+
+class block_subscriber;
+using block_subscriber_ptr = std::shared_ptr<block_subscriber>;
+
+/// what happens to a subscriber more than its max lag behind
+enum class slow_subscriber_policy {
+   disconnect, ///< finish it with RESOURCE_EXHAUSTED
+   catchup     ///< read its irreversible blocks from blocks.log until it is back in the window, head subscribers are disconnected
+};
+
+/**
+ * The recent events of one stream, irreversible or head. Events are numbered by seq, the block
+ * number for irreversible blocks and a counter for head blocks. Events are only published while
+ * the stream has subscribers and the window is dropped when the last one leaves.
+ */
+class block_feed {
+public:
+   enum class next_result { event, wait, behind };
+
+   explicit block_feed(size_t window) : max_window(std::max<size_t>(window, 1)) {}
+
+   uint32_t subscriber_count() const { return subscribers; }
+
+   void add(const block_subscriber_ptr& sub) {
+      std::lock_guard<std::mutex> lock(mtx);
+      ++subscribers;
+      members.push_back(sub);
+   }
+
+   void remove() {
+      std::lock_guard<std::mutex> lock(mtx);
+      if( --subscribers == 0 ) {
+         window.clear();
+         members.clear();
+      }
+   }
+
+   /// @return the subscribers, to wake
+   std::vector<block_subscriber_ptr> publish(feed_event_ptr e) {
+      std::lock_guard<std::mutex> lock(mtx);
+      if( subscribers == 0 )
+         return {};
+      if( !window.empty() && e->seq != window.back()->seq + 1 )
+         window.clear(); // published again after a time without subscribers
+      window.push_back(std::move(e));
+      if( window.size() > max_window )
+         window.pop_front();
+      return live_members();
+   }
+
+   std::vector<block_subscriber_ptr> snapshot() {
+      std::lock_guard<std::mutex> lock(mtx);
+      return live_members();
+   }
+
+   /**
+    * The event at cursor, or wait for the next publish. Behind when cursor left the window or,
+    * for blocks.log readers, is not in the window and at most log_up_to.
+    */
+   next_result next(uint64_t cursor, uint64_t log_up_to, feed_event_ptr& out) const {
+      std::lock_guard<std::mutex> lock(mtx);
+      if( !window.empty() && cursor >= window.front()->seq && cursor <= window.back()->seq ) {
+         out = window[cursor - window.front()->seq];
+         return next_result::event;
+      }
+      if( (!window.empty() && cursor < window.front()->seq) || cursor <= log_up_to )
+         return next_result::behind;
+      return next_result::wait;
+   }
+
+   /// 0 before the first event
+   uint64_t last_seq() const {
+      std::lock_guard<std::mutex> lock(mtx);
+      return window.empty() ? 0 : window.back()->seq;
+   }
+
+   /// seq of the first event of block num or later in the window, 0 if none; older if num is before the window
+   uint64_t find_block(uint32_t num, bool& older) const {
+      std::lock_guard<std::mutex> lock(mtx);
+      older = !window.empty() && window.front()->block_num > num;
+      for( const auto& e : window )
+         if( e->block_num >= num ) return e->seq;
+      return 0;
+   }
+
+private:
+   /// under mtx, drops the subscribers that are gone
+   std::vector<block_subscriber_ptr> live_members() {
+      std::vector<block_subscriber_ptr> live;
+      live.reserve(members.size());
+      auto keep = members.begin();
+      for( auto itr = members.begin(); itr != members.end(); ++itr ) {
+         if( auto sub = itr->lock() ) {
+            live.push_back(std::move(sub));
+            *keep++ = *itr;
+         }
+      }
+      members.erase(keep, members.end());
+      return live;
+   }
+
+   const size_t max_window;
+   mutable std::mutex mtx;
+   std::deque<feed_event_ptr> window;
+   std::vector<std::weak_ptr<block_subscriber>> members;
+   std::atomic<uint32_t> subscribers{0};
+};
+
+/**
+ * Block_Service.subscribe. The controller signals post blocks to a single feed thread, which
+ * serializes each block once into a feed_event of its stream; all subscribers write the same
+ * slice. A stream nobody follows costs a counter check per block. Irreversible subscribers
+ * before the window read blocks.log on a catch-up pool instead, one subscriber at a time per thread.
+ */
+class block_subscriptions : public std::enable_shared_from_this<block_subscriptions> {
+public:
+   block_subscriptions(size_t window, uint32_t max_lag, slow_subscriber_policy policy, uint32_t catchup_threads)
+   : irreversible(window), head(window), max_lag(std::max<uint64_t>(std::min<uint64_t>(max_lag, window), 1)),
+     policy(policy), catchup_pool(std::max<uint32_t>(catchup_threads, 1)), feed_pool(1) {}
+
+   /// on the application thread from plugin_startup, once the controller has an irreversible block to seed from
+   void connect(chain::controller& chain) {
+      blocks_dir = chain.get_config().blocks_dir;
+      last_irreversible = chain.last_irreversible_block_num();
+      std::weak_ptr<block_subscriptions> weak = shared_from_this();
+      irreversible_connection = chain.irreversible_block.connect([weak](const chain::block_state_ptr& bs) {
+         if( auto self = weak.lock() )
+            self->on_block(bs, true);
+      });
+      accepted_connection = chain.accepted_block.connect([weak](const chain::block_state_ptr& bs) {
+         if( auto self = weak.lock() )
+            self->on_block(bs, false);
+      });
+   }
+
+   /// on the application thread, every subscriber is finished with UNAVAILABLE
+   void stop();
+
+   bool stopped() const { return is_stopped; }
+
+   block_feed irreversible;
+   block_feed head;
+   const uint32_t max_lag;
+   const slow_subscriber_policy policy;
+   fc::path blocks_dir;
+   std::atomic<uint32_t> last_irreversible{0}; ///< irreversible blocks up to this one are in blocks.log
+   std::atomic<uint64_t> head_seq{0};          ///< seq of the last head event handed to the feed thread
+   boost::asio::thread_pool catchup_pool;
+
+private:
+   void on_block(const chain::block_state_ptr& bs, bool is_irreversible) {
+      // the controller appends to blocks.log before it signals the block irreversible
+      if( is_irreversible )
+         last_irreversible = bs->block_num;
+      auto& feed = is_irreversible ? irreversible : head;
+      if( feed.subscriber_count() == 0 || !bs->block )
+         return;
+      const uint64_t seq = is_irreversible ? bs->block_num : ++head_seq;
+      const uint32_t lib = bs->dpos_irreversible_blocknum;
+      auto self = shared_from_this();
+      chain::signed_block_ptr block = bs->block;
+      boost::asio::post(feed_pool, [self, &feed, block, seq, lib]() {
+         if( self->is_stopped )
+            return;
+         const auto packed = fc::raw::pack(*block);
+         auto e = make_feed_event(seq, make_block_message(*block, packed.data(), packed.size(), lib));
+         for( auto& sub : feed.publish(std::move(e)) )
+            wake(sub);
+      });
+   }
+
+   static void wake(const block_subscriber_ptr& sub);
+
+   std::atomic_bool is_stopped{false};
+   boost::asio::thread_pool feed_pool;
+   boost::signals2::scoped_connection irreversible_connection;
+   boost::signals2::scoped_connection accepted_connection;
+};
+
+/**
+ * One subscribe call, served through the generic service: it hands out the request and takes
+ * the replies as raw bytes, so the shared slices are written without being copied or
+ * serialized again. One write is in flight at a time and the next event is taken from the feed
+ * when it completes, so a subscriber holds a reference to the event it writes only. A
+ * subscriber more than max_lag behind the last event, its write held up by flow control
+ * included, is handled by the slow subscriber policy.
+ */
+class block_subscriber final : public std::enable_shared_from_this<block_subscriber> {
+public:
+   block_subscriber(grpc::AsyncGenericService& service, ServerCompletionQueue* cq,
+                    std::shared_ptr<block_subscriptions> subs, std::function<void()> arm_next)
+   : service(service), cq(cq), subs(std::move(subs)), arm_next(std::move(arm_next)) {}
+
+   void start() {
+      std::lock_guard<std::mutex> lock(mtx);
+      self = shared_from_this();
+      requesting = true;
+      service.RequestCall(&context, &stream, cq, cq, &request_op);
+   }
+
+   /// from the feed thread after a publish, or when the subscriptions stop
+   void wake() {
+      block_subscriber_ptr released;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         if( !feed || finishing || finished ) {
+            // not subscribed yet, or done
+         } else if( subs->stopped() ) {
+            if( !writing && !reading_log )
+               finish(Status(grpc::StatusCode::UNAVAILABLE, "shutting down"));
+         } else if( writing ) {
+            if( lagging() && (is_head || subs->policy == slow_subscriber_policy::disconnect) )
+               context.TryCancel();
+         } else if( !reading_log ) {
+            if( lagging() )
+               fall_behind();
+            else
+               send_next();
+         }
+         released = settle();
+      }
+   }
+
+private:
+   void on_request(bool ok) {
+      // the server is shutting down when no request came
+      if( ok )
+         arm_next();
+      block_subscriber_ptr released;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         requesting = false;
+         if( !ok ) {
+            finished = true;
+         } else if( context.method() != "/eosio_grpc_server.Block_Service/subscribe" ) {
+            finish(Status(grpc::StatusCode::UNIMPLEMENTED, "unknown method " + context.method()));
+         } else {
+            reading = true;
+            stream.Read(&in, &read_op);
+         }
+         released = settle();
+      }
+   }
+
+   void on_read(bool ok) {
+      block_subscriber_ptr released;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         reading = false;
+         SubscribeRequest request;
+         if( !ok )
+            finish(Status(grpc::StatusCode::INVALID_ARGUMENT, "no SubscribeRequest"));
+         else if( subs->stopped() )
+            finish(Status(grpc::StatusCode::UNAVAILABLE, "shutting down"));
+         else if( !parse(request) )
+            finish(Status(grpc::StatusCode::INVALID_ARGUMENT, "unable to parse SubscribeRequest"));
+         else
+            subscribe(request);
+         released = settle();
+      }
+   }
+
+   void on_write(bool ok) {
+      block_subscriber_ptr released;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         writing = false;
+         current.reset();
+         if( !ok ) {
+            finish(Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "subscriber gone or too slow"));
+         } else if( subs->stopped() ) {
+            finish(Status(grpc::StatusCode::UNAVAILABLE, "shutting down"));
+         } else {
+            ++cursor;
+            if( lagging() )
+               fall_behind();
+            else
+               send_next();
+         }
+         released = settle();
+      }
+   }
+
+   void on_finish(bool ok) {
+      block_subscriber_ptr released;
+      {
+         std::lock_guard<std::mutex> lock(mtx);
+         finishing = false;
+         finished = true;
+         released = settle();
+      }
+   }
+
+   bool parse(SubscribeRequest& request) {
+      std::vector<grpc::Slice> slices;
+      if( !in.Dump(&slices).ok() )
+         return false;
+      std::string bytes;
+      for( const auto& s : slices )
+         bytes.append(reinterpret_cast<const char*>(s.begin()), s.size());
+      return request.ParseFromString(bytes);
+   }
+
+   void subscribe(const SubscribeRequest& request) {
+      is_head = request.stream() == SubscribeRequest::HEAD;
+      max_lag = request.max_lag() > 0 && request.max_lag() < subs->max_lag ? request.max_lag() : subs->max_lag;
+      feed = is_head ? &subs->head : &subs->irreversible;
+      feed->add(shared_from_this());
+      if( is_head ) {
+         cursor = subs->head_seq + 1;
+         if( request.start_block_num() > 0 ) {
+            bool older = false;
+            if( const uint64_t seq = feed->find_block(request.start_block_num(), older) )
+               cursor = seq;
+            if( older ) {
+               finish(Status(grpc::StatusCode::OUT_OF_RANGE, "head blocks before the window are not kept, subscribe to irreversible blocks"));
+               return;
+            }
+         }
+      } else {
+         cursor = request.start_block_num() > 0 ? request.start_block_num() : subs->last_irreversible + 1;
+      }
+      send_next();
+   }
+
+   bool lagging() const {
+      const uint64_t last = feed->last_seq();
+      return !catching_up && last > cursor && last - cursor > max_lag;
+   }
+
+   void fall_behind() {
+      if( is_head || subs->policy == slow_subscriber_policy::disconnect ) {
+         finish(Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "subscriber fell more than " + std::to_string(max_lag) + " blocks behind"));
+         return;
+      }
+      catching_up = true;
+      send_next();
+   }
+
+   /// under mtx with nothing in flight
+   void send_next() {
+      feed_event_ptr e;
+      switch( feed->next(cursor, is_head ? 0 : subs->last_irreversible.load(), e) ) {
+         case block_feed::next_result::event:
+            catching_up = false;
+            write(std::move(e));
+            break;
+         case block_feed::next_result::wait:
+            catching_up = false;
+            break;
+         case block_feed::next_result::behind:
+            if( is_head ) {
+               finish(Status(grpc::StatusCode::OUT_OF_RANGE, "fell out of the head block window"));
+            } else {
+               catching_up = true;
+               read_log();
+            }
+            break;
+      }
+   }
+
+   void read_log() {
+      reading_log = true;
+      auto me = shared_from_this();
+      const uint32_t num = cursor;
+      boost::asio::post(subs->catchup_pool, [me, num]() {
+         feed_event_ptr e;
+         Status status(grpc::StatusCode::UNAVAILABLE, "shutting down");
+         if( !me->subs->stopped() ) {
+            try {
+               if( !me->log ) {
+                  me->log.reset(new block_log_reader());
+                  me->log->open(me->subs->blocks_dir);
+               }
+               if( num < me->log->first_block_num() ) {
+                  status = Status(grpc::StatusCode::OUT_OF_RANGE, "block " + std::to_string(num) + " is before the block log");
+               } else {
+                  me->log->read(num, num, me->log_buffer, me->log_offsets);
+                  // the packed block ends where decoding it ends, the entry may hold more than the block
+                  fc::datastream<const char*> ds(me->log_buffer.data(), me->log_offsets[1]);
+                  chain::signed_block block;
+                  fc::raw::unpack(ds, block);
+                  EOS_ASSERT( block.block_num() == num, chain::block_log_exception,
+                              "block log has block ${n} where ${e} was expected", ("n", block.block_num())("e", num));
+                  const size_t size = ds.tellp();
+                  e = make_feed_event(num, make_block_message(block, me->log_buffer.data(), size, me->subs->last_irreversible));
+               }
+            } catch( const fc::exception& ex ) {
+               status = Status(grpc::StatusCode::INTERNAL, ex.to_string());
+            } catch( const std::exception& ex ) {
+               status = Status(grpc::StatusCode::INTERNAL, ex.what());
+            }
+         }
+         block_subscriber_ptr released;
+         {
+            std::lock_guard<std::mutex> lock(me->mtx);
+            me->reading_log = false;
+            if( e && !me->subs->stopped() )
+               me->write(std::move(e));
+            else
+               me->finish(e ? Status(grpc::StatusCode::UNAVAILABLE, "shutting down") : status);
+            released = me->settle();
+         }
+      });
+   }
+
+   void write(feed_event_ptr e) {
+      writing = true;
+      current = std::move(e);
+      out = grpc::ByteBuffer(&current->slice, 1);
+      stream.Write(out, &write_op);
+   }
+
+   void finish(const Status& status) {
+      if( finishing || finished )
+         return;
+      finishing = true;
+      stream.Finish(status, &finish_op);
+   }
+
+   /// @return the call's own reference once it is finished and nothing is in flight, to drop after unlocking
+   block_subscriber_ptr settle() {
+      if( !finished || requesting || reading || writing || finishing || reading_log || !self )
+         return block_subscriber_ptr();
+      if( feed )
+         feed->remove();
+      feed = nullptr;
+      return std::move(self);
+   }
+
+   grpc::AsyncGenericService& service;
+   ServerCompletionQueue* cq;
+   std::shared_ptr<block_subscriptions> subs;
+   std::function<void()> arm_next;
+
+   grpc::GenericServerContext context;
+   grpc::GenericServerAsyncReaderWriter stream{&context};
+   call_op<block_subscriber> request_op{*this, &block_subscriber::on_request};
+   call_op<block_subscriber> read_op{*this, &block_subscriber::on_read};
+   call_op<block_subscriber> write_op{*this, &block_subscriber::on_write};
+   call_op<block_subscriber> finish_op{*this, &block_subscriber::on_finish};
+
+   std::mutex mtx;
+   block_subscriber_ptr self; ///< keeps the call alive while it is served
+   grpc::ByteBuffer in;
+   grpc::ByteBuffer out;
+   feed_event_ptr current;    ///< the event being written
+   block_feed* feed = nullptr;
+   std::unique_ptr<block_log_reader> log; ///< opened on the first catch-up read
+   std::vector<char> log_buffer;
+   std::vector<uint64_t> log_offsets;
+   uint64_t cursor = 0;       ///< seq of the next event to write
+   uint64_t max_lag = 0;
+   bool is_head = false;
+   bool catching_up = false;
+   bool requesting = false;
+   bool reading = false;
+   bool reading_log = false;
+   bool writing = false;
+   bool finishing = false;
+   bool finished = false;
+};
+
+void block_subscriptions::wake(const block_subscriber_ptr& sub)
+{
+   sub->wake();
+}
+
+void block_subscriptions::stop()
+{
+   is_stopped = true;
+   irreversible_connection.disconnect();
+   accepted_connection.disconnect();
+   // queued work sees is_stopped and returns
+   feed_pool.join();
+   catchup_pool.join();
+   for( auto* feed : { &irreversible, &head } ) {
+      for( auto& sub : feed->snapshot() )
+         wake(sub);
+   }
+}
+
+/// subscribe on one completion queue, every call arms its successor once it has a request
+class subscribe_method final : public rpc_method {
+public:
+   subscribe_method(grpc::AsyncGenericService& service, ServerCompletionQueue* cq, std::shared_ptr<block_subscriptions> subs)
+   : service(service), cq(cq), subs(std::move(subs)) {}
+
+   void arm() override {
+      if( subs->stopped() )
+         return;
+      std::make_shared<block_subscriber>(service, cq, subs, [this]() { arm(); })->start();
+   }
+
+private:
+   grpc::AsyncGenericService& service;
+   ServerCompletionQueue* cq;
+   std::shared_ptr<block_subscriptions> subs;
+};
+
+/**
+ * Async server: every rpc method is posted on each of several completion queues, which are
+ * polled by a configurable number of threads, optionally pinned to cores. Handlers run on the
+ * polling threads and must not block.
+ */
+class grpc_server_plugin_impl {
 public:
    ~grpc_server_plugin_impl();
    std::string server_address = std::string("");
+   uint32_t thread_count = 2;
+   uint32_t completion_queue_count = 0; ///< 0 for one per thread
+   uint32_t calls_per_queue = 16;       ///< calls of each method waiting for a request on each queue
+   bool pin_threads = false;
+   uint32_t first_core = 0;
+   uint32_t trx_threads = 0;            ///< 0 disables push_transactions
+   uint32_t trx_batch_size = 200;
+   uint32_t trx_max_in_flight = 1000;   ///< per stream
+   uint32_t query_threads = 0;          ///< 0 disables Query_Service
+   uint32_t query_cache_entries = 10000;
+   uint32_t subscribe_window = 0;       ///< blocks kept per subscription stream, 0 disables Block_Service
+   uint32_t subscribe_max_lag = 100;
+   slow_subscriber_policy subscribe_policy = slow_subscriber_policy::catchup;
+   uint32_t subscribe_catchup_threads = 1;
    void init();
-   void runServer();
-   boost::thread server_thread;
-   Status rpc_sendaction(ServerContext* context, const EosRequest* request,
-        EosReply* reply) override;
+   void shutdown();
+   Status rpc_sendaction(const EosRequest* request, EosReply* reply);
+
+private:
+   template<typename Request, typename Reply, typename Handler>
+   void add_unary(ServerCompletionQueue* cq, typename unary_method<Request, Reply>::request_fn request, Handler&& handler);
+   void add_queries(ServerCompletionQueue* cq);
+   void poll(ServerCompletionQueue* cq);
+   void pin(boost::thread& thread, uint32_t core);
+
+   Eos_Service::AsyncService eos_service;
+   Stats_Service::AsyncService stats_service;
+   Transaction_Service::AsyncService transaction_service;
+   std::shared_ptr<transaction_ingest> ingest;
+   Query_Service::AsyncService query_service;
+   std::shared_ptr<state_query_service> queries;
+   grpc::AsyncGenericService block_service; ///< Block_Service, written as pre-serialized bytes
+   std::shared_ptr<block_subscriptions> subscriptions;
+   std::unique_ptr<Server> server;
+   std::vector<std::unique_ptr<ServerCompletionQueue>> completion_queues;
+   std::vector<std::unique_ptr<rpc_method>> methods;
+   std::vector<boost::thread> threads;
 };
 
-Status grpc_server_plugin_impl::rpc_sendaction(ServerContext* context, const EosRequest* request,
-                EosReply* reply){
+Status grpc_server_plugin_impl::rpc_sendaction(const EosRequest* request, EosReply* reply){
     std::string prefix("GetAction:");
     reply->set_message(prefix +request->action()+ "\r\n" +request->json());
     return Status::OK;
 }
 
-void grpc_server_plugin_impl::runServer()
+template<typename Request, typename Reply, typename Handler>
+void grpc_server_plugin_impl::add_unary(ServerCompletionQueue* cq, typename unary_method<Request, Reply>::request_fn request, Handler&& handler)
+{
+   methods.emplace_back(new unary_method<Request, Reply>(cq, std::move(request), std::forward<Handler>(handler)));
+}
+
+void grpc_server_plugin_impl::add_queries(ServerCompletionQueue* cq)
+{
+   using finish_fn = state_query_service::finish_fn;
+   add_unary<TableRowsRequest, QueryReply>(cq,
+      [this](ServerContext* ctx, TableRowsRequest* req, grpc::ServerAsyncResponseWriter<QueryReply>* w, ServerCompletionQueue* cq, void* tag) {
+         query_service.Requestget_table_rows(ctx, req, w, cq, cq, tag);
+      },
+      [this](const TableRowsRequest& req, QueryReply& reply, finish_fn finish) {
+         queries->query<read_only::get_table_rows_params>("get_table_rows:" + req.SerializeAsString(), reply, std::move(finish),
+            [req]() {
+               fc::mutable_variant_object params;
+               params("json", req.json())("code", req.code())("scope", req.scope())("table", req.table())
+                     ("limit", req.limit() ? req.limit() : 10);
+               if( !req.table_key().empty() ) params("table_key", req.table_key());
+               if( !req.lower_bound().empty() ) params("lower_bound", req.lower_bound());
+               if( !req.upper_bound().empty() ) params("upper_bound", req.upper_bound());
+               if( !req.key_type().empty() ) params("key_type", req.key_type());
+               if( !req.index_position().empty() ) params("index_position", req.index_position());
+               if( !req.encode_type().empty() ) params("encode_type", req.encode_type());
+               return fc::variant(params).as<read_only::get_table_rows_params>();
+            },
+            [](const read_only& ro, const read_only::get_table_rows_params& p) { return ro.get_table_rows(p); });
+      });
+   add_unary<AccountRequest, QueryReply>(cq,
+      [this](ServerContext* ctx, AccountRequest* req, grpc::ServerAsyncResponseWriter<QueryReply>* w, ServerCompletionQueue* cq, void* tag) {
+         query_service.Requestget_account(ctx, req, w, cq, cq, tag);
+      },
+      [this](const AccountRequest& req, QueryReply& reply, finish_fn finish) {
+         queries->query<read_only::get_account_params>("get_account:" + req.SerializeAsString(), reply, std::move(finish),
+            [req]() {
+               return fc::variant(fc::mutable_variant_object("account_name", req.account_name())).as<read_only::get_account_params>();
+            },
+            [](const read_only& ro, const read_only::get_account_params& p) { return ro.get_account(p); });
+      });
+   add_unary<CurrencyBalanceRequest, QueryReply>(cq,
+      [this](ServerContext* ctx, CurrencyBalanceRequest* req, grpc::ServerAsyncResponseWriter<QueryReply>* w, ServerCompletionQueue* cq, void* tag) {
+         query_service.Requestget_currency_balance(ctx, req, w, cq, cq, tag);
+      },
+      [this](const CurrencyBalanceRequest& req, QueryReply& reply, finish_fn finish) {
+         queries->query<read_only::get_currency_balance_params>("get_currency_balance:" + req.SerializeAsString(), reply, std::move(finish),
+            [req]() {
+               fc::mutable_variant_object params;
+               params("code", req.code())("account", req.account());
+               if( !req.symbol().empty() ) params("symbol", req.symbol());
+               return fc::variant(params).as<read_only::get_currency_balance_params>();
+            },
+            [](const read_only& ro, const read_only::get_currency_balance_params& p) { return ro.get_currency_balance(p); });
+      });
+}
+
+void grpc_server_plugin_impl::init()
 {
    ServerBuilder builder;
    builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
-   builder.RegisterService(this);
-   std::unique_ptr<Server> server(builder.BuildAndStart());
-   server->Wait();
+   builder.RegisterService(&eos_service);
+   builder.RegisterService(&stats_service);
+   if( trx_threads > 0 ) {
+      ingest = std::make_shared<transaction_ingest>(trx_threads, trx_batch_size);
+      builder.RegisterService(&transaction_service);
+   }
+   if( query_threads > 0 ) {
+      queries = std::make_shared<state_query_service>(query_threads, query_cache_entries);
+      queries->connect(app().get_plugin<chain_plugin>().chain());
+      builder.RegisterService(&query_service);
+   }
+   if( subscribe_window > 0 ) {
+      subscriptions = std::make_shared<block_subscriptions>(subscribe_window, subscribe_max_lag, subscribe_policy, subscribe_catchup_threads);
+      subscriptions->connect(app().get_plugin<chain_plugin>().chain());
+      builder.RegisterAsyncGenericService(&block_service);
+   }
+   for( uint32_t i = 0; i < completion_queue_count; ++i )
+      completion_queues.emplace_back(builder.AddCompletionQueue());
+   server = builder.BuildAndStart();
+   EOS_ASSERT( server, chain::plugin_config_exception, "unable to start grpc server on ${a}", ("a", server_address));
+
+   for( auto& cq : completion_queues ) {
+      add_unary<EosRequest, EosReply>(cq.get(),
+         [this](ServerContext* ctx, EosRequest* req, grpc::ServerAsyncResponseWriter<EosReply>* w, ServerCompletionQueue* cq, void* tag) {
+            eos_service.Requestrpc_sendaction(ctx, req, w, cq, cq, tag);
+         },
+         [this](const EosRequest& req, EosReply& reply) { return rpc_sendaction(&req, &reply); });
+      add_unary<StatsRequest, StatsReply>(cq.get(),
+         [this](ServerContext* ctx, StatsRequest* req, grpc::ServerAsyncResponseWriter<StatsReply>* w, ServerCompletionQueue* cq, void* tag) {
+            stats_service.Requestget_stats(ctx, req, w, cq, cq, tag);
+         },
+         [](const StatsRequest& req, StatsReply& reply) { return get_stats(&req, &reply); });
+      if( ingest )
+         methods.emplace_back(new push_transactions_method(transaction_service, cq.get(), ingest, trx_max_in_flight));
+      if( queries )
+         add_queries(cq.get());
+      if( subscriptions )
+         methods.emplace_back(new subscribe_method(block_service, cq.get(), subscriptions));
+   }
+   for( auto& m : methods ) {
+      for( uint32_t i = 0; i < calls_per_queue; ++i )
+         m->arm();
+   }
+
+   for( uint32_t i = 0; i < thread_count; ++i ) {
+      auto* cq = completion_queues[i % completion_queues.size()].get();
+      threads.emplace_back([this, cq] { poll(cq); });
+      if( pin_threads )
+         pin(threads.back(), first_core + i);
+   }
+   ilog("grpc server listening on ${a} with ${t} threads on ${q} completion queues",
+        ("a", server_address)("t", thread_count)("q", completion_queues.size()));
 }
 
-void grpc_server_plugin_impl::init()
+void grpc_server_plugin_impl::poll(ServerCompletionQueue* cq)
+{
+   void* tag = nullptr;
+   bool ok = false;
+   while( cq->Next(&tag, &ok) )
+      static_cast<async_call*>(tag)->proceed(ok);
+}
+
+void grpc_server_plugin_impl::pin(boost::thread& thread, uint32_t core)
 {
-   server_thread = boost::thread([this] { runServer(); });
+#ifdef __linux__
+   const uint32_t cores = std::max<uint32_t>(std::thread::hardware_concurrency(), 1);
+   cpu_set_t set;
+   CPU_ZERO(&set);
+   CPU_SET(core % cores, &set);
+   const int r = pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+   if( r != 0 )
+      wlog("unable to pin grpc server thread to core ${c}: ${e}", ("c", core % cores)("e", strerror(r)));
+#else
+   wlog("grpc-server-pin-threads is only supported on linux");
+#endif
+}
+
+void grpc_server_plugin_impl::shutdown()
+{
+   if( !server )
+      return;
+   // streams and queries stop answering before the queues go away
+   if( ingest )
+      ingest->stop();
+   if( queries )
+      queries->stop();
+   if( subscriptions )
+      subscriptions->stop();
+   // calls in progress get a second to finish, then every queue drains and its threads exit
+   server->Shutdown(std::chrono::system_clock::now() + std::chrono::seconds(1));
+   for( auto& cq : completion_queues )
+      cq->Shutdown();
+   for( auto& t : threads )
+      t.join();
+   threads.clear();
+   methods.clear();
+   completion_queues.clear();
+   server.reset();
+   ingest.reset();
+   queries.reset();
+   subscriptions.reset();
 }
 
 grpc_server_plugin_impl::~grpc_server_plugin_impl()
 {
-      server_thread.interrupt();
+   shutdown();
 }
 ////////////
 // grpc_server_plugin
@@ -104,6 +1372,36 @@ void grpc_server_plugin::set_program_options(options_description& cli, options_d
    cfg.add_options()
          ("grpc-server-address", bpo::value<std::string>(),
          "grpc-server-address string.grcp server bind ip and port. Example:0.0.0.0:21005")
+         ("grpc-server-threads", bpo::value<uint32_t>()->default_value(2),
+         "Number of threads polling the server completion queues.")
+         ("grpc-server-completion-queues", bpo::value<uint32_t>()->default_value(0),
+         "Number of server completion queues, each polled by grpc-server-threads / queues threads. 0 for one per thread.")
+         ("grpc-server-calls-per-queue", bpo::value<uint32_t>()->default_value(16),
+         "Calls of each rpc method kept waiting for a request on every completion queue.")
+         ("grpc-server-pin-threads", bpo::bool_switch()->default_value(false),
+         "Pin polling thread i to core grpc-server-first-core + i (linux only).")
+         ("grpc-server-first-core", bpo::value<uint32_t>()->default_value(0),
+         "First core polling threads are pinned to with grpc-server-pin-threads.")
+         ("grpc-server-trx-threads", bpo::value<uint32_t>()->default_value(0),
+         "Threads unpacking transactions of the Transaction_Service.push_transactions "
+         "stream. 0 disables the rpc.")
+         ("grpc-server-trx-batch", bpo::value<uint32_t>()->default_value(200),
+         "Maximum number of pushed transactions handed to the chain per application thread task.")
+         ("grpc-server-trx-max-in-flight", bpo::value<uint32_t>()->default_value(1000),
+         "Transactions of one push_transactions stream waiting for their result before the server stops reading it.")
+         ("grpc-server-query-threads", bpo::value<uint32_t>()->default_value(0),
+         "Threads of the Query_Service read pool, chain state itself is read on the application thread. 0 disables the service.")
+         ("grpc-server-query-cache-entries", bpo::value<uint32_t>()->default_value(10000),
+         "Maximum number of Query_Service replies cached until the next accepted block.")
+         ("grpc-server-subscribe-window", bpo::value<uint32_t>()->default_value(0),
+         "Serialized blocks kept per Block_Service.subscribe stream, irreversible and head, for subscribers to read. 0 disables the service.")
+         ("grpc-server-subscribe-max-lag", bpo::value<uint32_t>()->default_value(100),
+         "Blocks a subscriber may fall behind the newest one, at most the window. Subscribers may ask for less.")
+         ("grpc-server-subscribe-slow-policy", bpo::value<std::string>()->default_value("catchup"),
+         "What happens to a subscriber beyond its lag: disconnect, or catchup to read irreversible blocks from blocks.log "
+         "until it is back in the window. Head subscribers are always disconnected.")
+         ("grpc-server-subscribe-catchup-threads", bpo::value<uint32_t>()->default_value(1),
+         "Threads reading blocks.log for irreversible subscribers before the window.")
          ;
 }
 
@@ -119,17 +1417,70 @@ void grpc_server_plugin::plugin_initialize(const variables_map& options)
          {
                return ;
          }
-         my->init();
+         if( options.count( "grpc-server-threads" )) {
+            my->thread_count = options.at( "grpc-server-threads" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-server-completion-queues" )) {
+            my->completion_queue_count = options.at( "grpc-server-completion-queues" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-server-calls-per-queue" )) {
+            my->calls_per_queue = options.at( "grpc-server-calls-per-queue" ).as<uint32_t>();
+         }
+         my->pin_threads = options.at( "grpc-server-pin-threads" ).as<bool>();
+         if( options.count( "grpc-server-first-core" )) {
+            my->first_core = options.at( "grpc-server-first-core" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-server-trx-threads" )) {
+            my->trx_threads = options.at( "grpc-server-trx-threads" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-server-trx-batch" )) {
+            my->trx_batch_size = options.at( "grpc-server-trx-batch" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-server-trx-max-in-flight" )) {
+            my->trx_max_in_flight = options.at( "grpc-server-trx-max-in-flight" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-server-query-threads" )) {
+            my->query_threads = options.at( "grpc-server-query-threads" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-server-query-cache-entries" )) {
+            my->query_cache_entries = options.at( "grpc-server-query-cache-entries" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-server-subscribe-window" )) {
+            my->subscribe_window = options.at( "grpc-server-subscribe-window" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-server-subscribe-max-lag" )) {
+            my->subscribe_max_lag = options.at( "grpc-server-subscribe-max-lag" ).as<uint32_t>();
+         }
+         if( options.count( "grpc-server-subscribe-slow-policy" )) {
+            const auto policy = options.at( "grpc-server-subscribe-slow-policy" ).as<std::string>();
+            EOS_ASSERT( policy == "disconnect" || policy == "catchup", chain::plugin_config_exception,
+                        "grpc-server-subscribe-slow-policy must be disconnect or catchup, got ${p}", ("p", policy));
+            my->subscribe_policy = policy == "disconnect" ? slow_subscriber_policy::disconnect : slow_subscriber_policy::catchup;
+         }
+         if( options.count( "grpc-server-subscribe-catchup-threads" )) {
+            my->subscribe_catchup_threads = options.at( "grpc-server-subscribe-catchup-threads" ).as<uint32_t>();
+         }
+         EOS_ASSERT( my->thread_count > 0, chain::plugin_config_exception, "grpc-server-threads must be at least 1" );
+         EOS_ASSERT( my->calls_per_queue > 0, chain::plugin_config_exception, "grpc-server-calls-per-queue must be at least 1" );
+         if( my->completion_queue_count == 0 )
+            my->completion_queue_count = my->thread_count;
+         EOS_ASSERT( my->completion_queue_count <= my->thread_count, chain::plugin_config_exception,
+                     "grpc-server-completion-queues ${q} needs at least as many grpc-server-threads, got ${t}",
+                     ("q", my->completion_queue_count)("t", my->thread_count));
       
    } FC_LOG_AND_RETHROW()
 }
 
 void grpc_server_plugin::plugin_startup()
 {
+   // the services read the chain head, which the controller only has once chain_plugin started
+   if( b_need_start )
+      my->init();
 }
 
 void grpc_server_plugin::plugin_shutdown()
 {
+   my->shutdown();
    my.reset();
 }
 
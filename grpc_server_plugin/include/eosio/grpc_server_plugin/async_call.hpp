@@ -0,0 +1,158 @@
+/**
+ *  @file
+ *  @copyright defined in eos/LICENSE.txt
+ */
+#pragma once
+
+#include <fc/exception/exception.hpp>
+
+#include <boost/optional.hpp>
+
+#include <grpcpp/grpcpp.h>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace eosio {
+
+/**
+ * State of one rpc on a completion queue of the async server. The call is the tag of its own
+ * completion queue events and the polling thread hands each event back to proceed.
+ */
+class async_call {
+public:
+   virtual ~async_call() {}
+   /// ok as returned by CompletionQueue::Next
+   virtual void proceed( bool ok ) = 0;
+};
+
+/// tag of one kind of operation of a call with several in flight, like the reads and writes of a stream
+template<typename Call>
+class call_op final : public async_call {
+public:
+   using handler = void (Call::*)( bool );
+   call_op( Call& owner, handler fn ) : owner( owner ), fn( fn ) {}
+   void proceed( bool ok ) override { (owner.*fn)( ok ); }
+private:
+   Call&    owner;
+   handler  fn;
+};
+
+/// one rpc method served on one completion queue
+class rpc_method {
+public:
+   virtual ~rpc_method() {}
+   /// posts one more call waiting for a request
+   virtual void arm() = 0;
+};
+
+/**
+ * A unary rpc on one completion queue. Call states are pooled: a finished call goes back to
+ * the free list and is reset in place for the next request, so its messages keep their
+ * capacity and serving a request allocates nothing beyond what gRPC does.
+ *
+ * A handler either returns its status on the polling thread, or is deferred and answers later
+ * through finish from any thread, filling the reply before it does.
+ */
+template<typename Request, typename Reply>
+class unary_method final : public rpc_method {
+public:
+   using responder_type = grpc::ServerAsyncResponseWriter<Reply>;
+   /// the generated AsyncService::RequestXxx of the method
+   using request_fn = std::function<void( grpc::ServerContext*, Request*, responder_type*, grpc::ServerCompletionQueue*, void* )>;
+   using handler_fn = std::function<grpc::Status( const Request&, Reply& )>;
+   using finish_fn = std::function<void( grpc::Status )>;
+   using deferred_handler_fn = std::function<void( const Request&, Reply&, finish_fn )>;
+
+   unary_method( grpc::ServerCompletionQueue* cq, request_fn request, deferred_handler_fn handler )
+   : cq( cq ), request( std::move( request )), handler( std::move( handler )) {}
+
+   unary_method( grpc::ServerCompletionQueue* cq, request_fn request, handler_fn handler )
+   : unary_method( cq, std::move( request ), deferred_handler_fn( [handler]( const Request& req, Reply& reply, finish_fn finish ) {
+        finish( handler( req, reply ));
+     } )) {}
+
+   void arm() override {
+      call* c = nullptr;
+      {
+         std::lock_guard<std::mutex> lock( mtx );
+         if( free_calls.empty() ) {
+            calls.emplace_back( new call( *this ));
+            c = calls.back().get();
+         } else {
+            c = free_calls.back();
+            free_calls.pop_back();
+         }
+      }
+      c->start();
+   }
+
+private:
+   class call final : public async_call {
+   public:
+      explicit call( unary_method& m ) : method( m ) {}
+
+      void start() {
+         request.Clear();
+         reply.Clear();
+         responder = boost::none;
+         context.emplace();
+         responder.emplace( &*context );
+         finishing = false;
+         answered = false;
+         method.request( &*context, &request, &*responder, method.cq, this );
+      }
+
+      void proceed( bool ok ) override {
+         // finished, or never got a request because the server is shutting down
+         if( finishing || !ok ) {
+            method.release( this );
+            return;
+         }
+         method.arm();
+         try {
+            method.handler( request, reply, [this]( grpc::Status status ) { finish( std::move( status )); } );
+         } catch( const fc::exception& e ) {
+            finish( grpc::Status( grpc::StatusCode::INTERNAL, e.to_string() ));
+         } catch( const std::exception& e ) {
+            finish( grpc::Status( grpc::StatusCode::INTERNAL, e.what() ));
+         } catch( ... ) {
+            finish( grpc::Status( grpc::StatusCode::INTERNAL, "unknown exception" ));
+         }
+      }
+
+   private:
+      /// only the first answer counts
+      void finish( grpc::Status status ) {
+         if( answered.exchange( true ))
+            return;
+         finishing = true;
+         responder->Finish( reply, status, this );
+      }
+
+      unary_method&                             method;
+      boost::optional<grpc::ServerContext>      context; ///< not reusable, rebuilt in place per request
+      boost::optional<responder_type>           responder;
+      Request                                   request;
+      Reply                                     reply;
+      bool                                      finishing = false;
+      std::atomic_bool                          answered{false};
+   };
+
+   void release( call* c ) {
+      std::lock_guard<std::mutex> lock( mtx );
+      free_calls.push_back( c );
+   }
+
+   grpc::ServerCompletionQueue*         cq;
+   request_fn                           request;
+   deferred_handler_fn                  handler;
+   std::mutex                           mtx;
+   std::vector<std::unique_ptr<call>>   calls;      ///< every call ever made, freed with the method
+   std::vector<call*>                   free_calls;
+};
+
+}
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <eosio/chain_plugin/chain_plugin.hpp>
+#include <eosio/grpc_client_plugin/grpc_client_plugin.hpp>
 #include <appbase/application.hpp>
 #include <memory>
 
@@ -19,7 +20,8 @@ using grpc_server_plugin_impl_ptr = std::shared_ptr<class grpc_server_plugin_imp
  */
 class grpc_server_plugin : public plugin<grpc_server_plugin> {
 public:
-   APPBASE_PLUGIN_REQUIRES((chain_plugin))
+   // Stats_Service reads the client's metrics, requiring it makes appbase shut this plugin down first
+   APPBASE_PLUGIN_REQUIRES((chain_plugin)(grpc_client_plugin))
 
    grpc_server_plugin();
    virtual ~grpc_server_plugin();